@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
@@ -16,12 +17,12 @@
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__, __x86_64__ and  __alpha
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
  *******************************************************/
@@ -108,6 +109,13 @@ static unsigned int counterRoutine[] =
 /* Cast the above instructions into a function. */
 static unsigned int (*counter)(void)= (void *)counterRoutine;
 
+/* Only the low order 32 bits of the counter are meaningful here */
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    *hi = 0;
+    *lo = counter();
+}
+
 
 void start_counter()
 {
@@ -143,6 +151,21 @@ double get_counter()
  * haven't provided a Sparc version here.
  ***************************************************************/
 
+/* 
+ * No cycle counter: count nanoseconds of the monotonic clock instead,
+ * so that callers of access_counter still see a 64-bit tick count.
+ */
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    struct timespec ts;
+    unsigned long long ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns = (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    *hi = (unsigned) (ns >> 32);
+    *lo = (unsigned) ns;
+}
+
 void start_counter()
 {
     printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
@@ -1,5 +1,8 @@
 /* Routines for using cycle counter */
 
+/* Read the raw 64-bit cycle counter as two 32-bit halves */
+void access_counter(unsigned *hi, unsigned *lo);
+
 /* Start the counter */
 void start_counter();
 
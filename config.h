@@ -53,15 +53,30 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (8, or 16 on 64 bit hosts)
  */
+#if defined(__LP64__) || defined(_WIN64)
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8  
+#endif
 
 /* 
  * Maximum heap size in bytes 
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Heap backend of memlib.c: 0 simulates the heap in a malloc'ed
+ * MAX_HEAP array (what the driver is scored on), 1 reserves VM_HEAP
+ * bytes of address space and commits them on demand.
+ */
+#ifndef MEM_VM
+#define MEM_VM 0
+#endif
+#define VM_HEAP ((size_t)1 << (sizeof(void *) == 8 ? 36 : 30)) /* 64 GB, 1 GB on 32 bit */
+#define MEM_COMMIT_CHUNK (1<<20)  /* commit granularity, 1 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -15,11 +15,19 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -31,26 +39,57 @@
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
+
+/* 
+ * Latency histograms are log-linear in the style of HdrHistogram:
+ * values below LAT_SUB get a bucket each, and every doubling above
+ * that is split into LAT_SUB equal sub-buckets, so a reported
+ * percentile is within 1/LAT_SUB of the true value.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+/* Multi-threaded replay */
+#define MT_REPS       20  /* times each thread replays its trace */
+#define MT_DRAIN_MASK 63  /* in cross mode, collect frees every 64 requests */
+#define MT_MBOX_SHARE 16  /* a mailbox holds at most 1/16 of the trace's peak live bytes */
+
+/* Heap growth test */
+#define GROW_BLOCK   60000 /* payload of every block the test allocates */
+#define GROW_THREADS 4     /* threads, each with its own arena, without -T */
+
+/* Batched replay */
+#define BATCH_MAX 256 /* most requests turned into one batch call */
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges form a treap
+ * ordered by lo, so finding the neighbours of a new block is O(log n).
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned prio;         /* random priority, max-heap ordered */
+    struct range_t *left;  /* ranges below lo */
+    struct range_t *right; /* ranges above lo */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC = TRACE_ALLOC, FREE = TRACE_FREE, REALLOC = TRACE_REALLOC} 
+    type;                             /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
 } traceop_t;
 
+/* Binary traces are replayed in place, so records must look like ops */
+typedef char traceop_is_trace_rec[sizeof(traceop_t) == sizeof(trace_rec_t) ? 1 : -1];
+
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -60,6 +99,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapped binary trace holding ops, or NULL */
+    size_t map_size;     /* bytes mapped at map */
 } trace_t;
 
 /* 
@@ -72,6 +113,43 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* An allocator driven by the multi-threaded replay */
+typedef struct {
+    char *name;
+    void *(*malloc_fn)(size_t size);
+    void (*free_fn)(void *ptr);
+    void *(*realloc_fn)(void *ptr, size_t size);
+    int is_mm;                     /* reset the mm heap before each run */
+} mt_alloc_t;
+
+/* 
+ * One replay thread. In cross-thread mode a thread does not free its
+ * own blocks: it posts them to the mailbox of its peer, which frees
+ * them the next time it drains the mailbox.
+ */
+typedef struct mt_thread {
+    pthread_t tid;
+    trace_t *trace;          /* trace this thread replays */
+    char **blocks;           /* live block of each trace id, or NULL */
+    int *sizes;              /* request size of each live block */
+    pthread_mutex_t lock;    /* protects the mbox fields */
+    char **mbox;             /* blocks posted by another thread */
+    int mbox_count, mbox_cap;
+    size_t mbox_bytes;       /* bytes requested for the blocks in mbox */
+    size_t mbox_max;         /* posting beyond this many bytes waits for a drain */
+    char **spare;            /* swapped with mbox when draining */
+    int spare_cap;
+    struct mt_thread *peer;  /* receives this thread's frees */
+    int failed;              /* an allocation request returned NULL */
+} mt_thread_t;
+
+/* Per-request latency distribution for one type of request */
+typedef struct {
+    unsigned long counts[LAT_BUCKETS]; /* samples in each bucket */
+    unsigned long n;                   /* total number of samples */
+    unsigned long long max;            /* largest sample seen */
+} lat_hist_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -90,6 +168,19 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int frag_interval = 0; /* print a fragmentation report every this many ops (-F) */
+static int latency = 0; /* report per-request latency percentiles (-L) */
+static lat_hist_t lat_total[3]; /* latencies summed over all traces */
+static int mt_threads = 0; /* replay on up to this many threads (-T) */
+static int mt_cross = 0;   /* free blocks on another thread than malloc'ed them (-X) */
+static int batch = 0;      /* replay once more through the batch calls (-B) */
+static size_t align = 0;   /* serve allocs with mm_memalign(align, size) (-A) */
+static size_t grow_target = 0; /* bytes the heap growth test allocates (-G) */
+static size_t grow_total;  /* bytes its threads have claimed so far */
+static mt_alloc_t *mt_alloc;  /* allocator of the current replay run */
+static pthread_barrier_t mt_start, mt_done;
+static int mt_nthreads;    /* threads of the current replay run */
+static int mt_finished;    /* those of them that are done replaying */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,14 +196,19 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_floor(range_t *t, char *addr);
+static range_t *range_insert(range_t *t, range_t *r);
+static range_t *range_join(range_t *a, range_t *b);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(char *path, trace_t *trace);
+static void alloc_blocks(trace_t *trace);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -121,9 +217,31 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void *trace_malloc(int size);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void print_frag(int tracenum, int opnum, int total_size);
+static void print_latency(char *label, lat_hist_t hists[3]);
+static void eval_mm_latency(trace_t *trace, int tracenum);
+
+/* Replay through mm_malloc_batch and mm_free_bulk */
+static int batch_end(trace_t *trace, int i);
+static int batch_replay(trace_t *trace, int tracenum, range_t **ranges, 
+			long *calls);
+static void eval_mm_batch_speed(void *ptr);
+static void eval_mm_batch(trace_t *trace, int tracenum, range_t **ranges, 
+			  double secs);
+
+/* Multi-threaded replay of the traces against mm or libc malloc */
+static void eval_mt(char **tracefiles, int num_tracefiles, int run_libc);
+static double mt_run(trace_t **traces, int num_traces, int nthreads, 
+		     long *ops);
+static void *mt_worker(void *arg);
+
+/* Growth of the mm heap on several arenas at once */
+static void eval_grow(int nthreads);
+static void *grow_worker(void *arg);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -158,7 +276,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:A:F:G:T:hvVgalBLX")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,6 +296,31 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'A': /* Allocate blocks aligned to a power of two */
+            align = strtoul(optarg, NULL, 0);
+            if (align == 0 || (align & (align - 1)) != 0) {
+                fprintf(stderr, "mdriver: alignment must be a power of two\n");
+                exit(1);
+            }
+            break;
+        case 'F': /* Print fragmentation reports while measuring util */
+            frag_interval = atoi(optarg);
+            break;
+        case 'G': /* Grow the heap to n MB on several arenas */
+            grow_target = strtoul(optarg, NULL, 0) << 20;
+            break;
+        case 'T': /* Replay the traces on up to n threads */
+            mt_threads = atoi(optarg);
+            break;
+        case 'X': /* Cross-thread frees in the multi-threaded replay */
+            mt_cross = 1;
+            break;
+        case 'B': /* Replay with mm_malloc_batch and mm_free_bulk too */
+            batch = 1;
+            break;
+        case 'L': /* Report per-request latency percentiles */
+            latency = 1;
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
@@ -303,9 +446,15 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (latency)
+		eval_mm_latency(trace, i);
+	    if (batch)
+		eval_mm_batch(trace, i, &ranges, mm_stats[i].secs);
 	}
 	free_trace(trace);
     }
+    if (latency)
+	print_latency("all traces", lat_total);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -357,6 +506,18 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
     }
 
+    /* 
+     * Optionally measure how throughput scales with threads
+     */
+    if (mt_threads > 0)
+	eval_mt(tracefiles, num_tracefiles, run_libc);
+
+    /* 
+     * Optionally check that several arenas can grow the heap together
+     */
+    if (grow_target > 0)
+	eval_grow(mt_threads > 1 ? mt_threads : GROW_THREADS);
+
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
 	printf("perfidx:%.0f\n", perfindex);
@@ -367,16 +528,82 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/*
+ * range_floor - Return the range with the highest lo <= addr, or NULL
+ */
+static range_t *range_floor(range_t *t, char *addr)
+{
+    range_t *best = NULL;
+
+    while (t != NULL) {
+	if (t->lo <= addr) {
+	    best = t;
+	    t = t->right;
+	}
+	else
+	    t = t->left;
+    }
+    return best;
+}
+
+/*
+ * range_insert - Insert r into treap t and return the new root
+ */
+static range_t *range_insert(range_t *t, range_t *r)
+{
+    range_t *child;
+
+    if (t == NULL)
+	return r;
+    if (r->lo < t->lo) {
+	t->left = range_insert(t->left, r);
+	if (t->left->prio > t->prio) { /* rotate right */
+	    child = t->left;
+	    t->left = child->right;
+	    child->right = t;
+	    return child;
+	}
+    }
+    else {
+	t->right = range_insert(t->right, r);
+	if (t->right->prio > t->prio) { /* rotate left */
+	    child = t->right;
+	    t->right = child->left;
+	    child->left = t;
+	    return child;
+	}
+    }
+    return t;
+}
+
+/*
+ * range_join - Merge treaps a and b, where every range of a lies
+ *     below every range of b, and return the new root
+ */
+static range_t *range_join(range_t *a, range_t *b)
+{
+    if (a == NULL)
+	return b;
+    if (b == NULL)
+	return a;
+    if (a->prio > b->prio) {
+	a->right = range_join(a->right, b);
+	return a;
+    }
+    b->left = range_join(a, b->left);
+    return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -404,27 +631,30 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. The payloads in
+     * the tree are disjoint, so only the one starting closest below hi
+     * can reach into [lo, hi].
+     */
+    p = range_floor(*ranges, hi);
+    if (p != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->prio = (unsigned)random();
+    p->left = p->right = NULL;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -434,17 +664,15 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
+    range_t **linkp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
+    for (p = *ranges;  p != NULL;  p = *linkp) {
         if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
+	    *linkp = range_join(p->left, p->right);
             free(p);
             break;
         }
-        prevpp = &(p->next);
+        linkp = (lo < p->lo) ? &p->left : &p->right;
     }
 }
 
@@ -453,13 +681,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
@@ -488,9 +716,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    /* Binary traces need no parsing */
     strcpy(path, tracedir);
     strcat(path, filename);
+    if (map_trace(path, trace))
+	return trace;
+
+    /* Read the trace file header */
+    trace->map = NULL;
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
@@ -504,16 +737,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->ops = 
 	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
+    alloc_blocks(trace);
     
     /* read every request line in the trace file */
     index = 0;
@@ -554,13 +778,94 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * alloc_blocks - Allocate the arrays that hold the blocks of a trace
+ */
+static void alloc_blocks(trace_t *trace)
+{
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * map_trace - If path is a binary trace (see trace.h), map it read-only
+ *     and point trace->ops at its records. Returns 0 for anything that
+ *     does not start with TRACE_MAGIC, so the caller can parse it as text.
+ */
+static int map_trace(char *path, trace_t *trace)
+{
+    int fd;
+    struct stat st;
+    trace_hdr_t *hdr;
+    trace_rec_t *recs;
+    uint32_t i;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(trace_hdr_t)) {
+	close(fd);
+	return 0;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+	return 0;
+    if (hdr->magic != TRACE_MAGIC) {
+	munmap(hdr, st.st_size);
+	return 0;
+    }
+    if (hdr->version != TRACE_VERSION || 
+	st.st_size != sizeof(trace_hdr_t) + 
+	(off_t)hdr->num_ops * sizeof(trace_rec_t)) {
+	sprintf(msg, "Binary trace %s has version %u and %ld bytes, "
+		"expected version %d and %ld bytes", path, hdr->version, 
+		(long)st.st_size, TRACE_VERSION, (long)(sizeof(trace_hdr_t) + 
+		(off_t)hdr->num_ops * sizeof(trace_rec_t)));
+	app_error(msg);
+    }
+
+    /* Replay indexes blocks by the records, so check them all up front */
+    recs = (trace_rec_t *)(hdr + 1);
+    for (i = 0; i < hdr->num_ops; i++) {
+	if ((recs[i].type != TRACE_ALLOC && recs[i].type != TRACE_FREE &&
+	     recs[i].type != TRACE_REALLOC) ||
+	    recs[i].index < 0 || (uint32_t)recs[i].index >= hdr->num_ids ||
+	    recs[i].size < 0) {
+	    snprintf(msg, sizeof(msg), "Binary trace %s has a bad record %u (type %d, "
+		    "index %d, size %d, %u ids)", path, i, recs[i].type,
+		    recs[i].index, recs[i].size, hdr->num_ids);
+	    app_error(msg);
+	}
+    }
+
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+    trace->map = hdr;
+    trace->map_size = st.st_size;
+    alloc_blocks(trace);
+    return 1;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* unmap or free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -571,6 +876,17 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * trace_malloc - Serve an alloc request of the trace, through
+ *     mm_memalign when -A asks for aligned blocks
+ */
+static void *trace_malloc(int size)
+{
+    if (align != 0)
+	return mm_memalign(align, size);
+    return mm_malloc(size);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -584,7 +900,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -604,18 +920,26 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = trace_malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
+
+	    /* With -A the block must also have the alignment asked for */
+	    if (align != 0 && ((uintptr_t)p % align) != 0) {
+		sprintf(msg, "Payload address (%p) not aligned to %lu bytes "
+			"as requested", p, (unsigned long)align);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -638,10 +962,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,7 +977,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -689,10 +1013,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap in bytes while running the student's malloc 
+ *   package on the trace. mem_sbrk() lets the package decrement the
+ *   brk pointer, so the final brk may be below that peak. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -717,7 +1040,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = trace_malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -772,12 +1095,59 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* Report fragmentation at every checkpoint and at the end */
+	if (frag_interval > 0 &&
+	    ((i+1) % frag_interval == 0 || i+1 == trace->num_ops))
+	    print_frag(tracenum, i+1, total_size);
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
+/*
+ * print_frag - Print how the heap looks after opnum ops of a trace,
+ *   given the total_size payload bytes the trace has live. Internal
+ *   waste is the share of in-use block bytes that no payload asked for
+ *   (headers, rounding, slab objects cached by the allocator); external
+ *   fragmentation is 1 - largest free block / free bytes.
+ */
+static void print_frag(int tracenum, int opnum, int total_size)
+{
+    mm_frag_t frag;
+    mm_stats_t stats;
+    size_t in_use;
+    int k;
+
+    mm_frag(&frag);
+    mm_stats(&stats);
+    in_use = frag.alloc_bytes + frag.slab_used_bytes + stats.mmap_bytes;
+
+    printf("frag trace %d op %d: heap %lu, in use %lu for %d payload "
+	   "(internal %.1f%%), slab runs %lu\n",
+	   tracenum, opnum, (unsigned long)frag.heap_bytes,
+	   (unsigned long)in_use, total_size,
+	   in_use ? 100.0 * (1.0 - (double)total_size / in_use) : 0.0,
+	   (unsigned long)frag.slab_bytes);
+    printf("\tfree %lu in %lu blocks, largest %lu (external %.1f%%)\n",
+	   (unsigned long)frag.free_bytes, (unsigned long)frag.free_blocks,
+	   (unsigned long)frag.largest_free,
+	   frag.free_bytes ?
+	   100.0 * (1.0 - (double)frag.largest_free / frag.free_bytes) : 0.0);
+
+    printf("\tfree sizes (2^k:blocks):");
+    for (k = 0; k < MM_FRAG_BINS; k++)
+	if (frag.free_hist[k])
+	    printf(" %d:%lu", k, (unsigned long)frag.free_hist[k]);
+    printf("\n\tbuckets (k:blocks/bytes):");
+    for (k = 0; k < MM_STATS_BUCKETS; k++)
+	if (frag.bucket_blocks[k])
+	    printf(" %d:%lu/%lu", k, (unsigned long)frag.bucket_blocks[k],
+		   (unsigned long)frag.bucket_bytes[k]);
+    printf("\n");
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -800,7 +1170,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = trace_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -825,6 +1195,704 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * read_cycles - Read the 64-bit cycle counter
+ */
+static unsigned long long read_cycles(void)
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/*
+ * lat_record - Add one latency sample to histogram h
+ */
+static void lat_record(lat_hist_t *h, unsigned long long v)
+{
+    int e, idx;
+
+    if (v < LAT_SUB) {
+	idx = (int)v;
+    }
+    else {
+	e = 63 - __builtin_clzll(v);
+	idx = (e - LAT_SUB_BITS + 1) * LAT_SUB + 
+	    (int)(v >> (e - LAT_SUB_BITS)) - LAT_SUB;
+    }
+    h->counts[idx]++;
+    h->n++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * lat_percentile - Return the largest value that falls in the same
+ *     bucket as the p-th percentile sample of h (0 < p <= 1)
+ */
+static unsigned long long lat_percentile(lat_hist_t *h, double p)
+{
+    unsigned long rank, seen = 0;
+    unsigned long long hi;
+    int idx, shift;
+
+    if (h->n == 0)
+	return 0;
+    rank = (unsigned long)(p * h->n);
+    if (rank < p * h->n || rank == 0)
+	rank++;
+    for (idx = 0; idx < LAT_BUCKETS; idx++) {
+	seen += h->counts[idx];
+	if (seen >= rank)
+	    break;
+    }
+    if (idx < LAT_SUB)
+	hi = idx;
+    else {
+	shift = idx / LAT_SUB - 1;
+	hi = ((unsigned long long)(idx % LAT_SUB + LAT_SUB + 1) << shift) - 1;
+    }
+    return hi < h->max ? hi : h->max;
+}
+
+/*
+ * print_latency - Print the latency percentiles of each request type
+ */
+static void print_latency(char *label, lat_hist_t hists[3])
+{
+    static char *names[3] = {"malloc", "free", "realloc"};
+    int t;
+
+    printf("latency %s (cycles):\n", label);
+    printf("\t%-8s %9s %8s %8s %8s %8s %10s\n",
+	   "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (t = 0; t < 3; t++) {
+	if (hists[t].n == 0)
+	    continue;
+	printf("\t%-8s %9lu %8llu %8llu %8llu %8llu %10llu\n", names[t],
+	       hists[t].n, lat_percentile(&hists[t], 0.5),
+	       lat_percentile(&hists[t], 0.9), lat_percentile(&hists[t], 0.99),
+	       lat_percentile(&hists[t], 0.999), hists[t].max);
+    }
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more, reading the cycle
+ *     counter around every request. This is a separate pass from
+ *     eval_mm_speed so that the timing does not distort the throughput
+ *     numbers; each sample includes the cost of one counter read.
+ */
+static void eval_mm_latency(trace_t *trace, int tracenum)
+{
+    static lat_hist_t hists[3];
+    unsigned long long start, cycles;
+    int i, j, k, index, size;
+    char *p;
+    char label[MAXLINE];
+
+    memset(hists, 0, sizeof(hists));
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    start = read_cycles();
+	    p = trace_malloc(size);
+	    cycles = read_cycles() - start;
+            if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    start = read_cycles();
+	    p = mm_realloc(trace->blocks[index], size);
+	    cycles = read_cycles() - start;
+            if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+	    start = read_cycles();
+            mm_free(trace->blocks[index]);
+	    cycles = read_cycles() - start;
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	    return;
+        }
+	lat_record(&hists[trace->ops[i].type], cycles);
+    }
+
+    /* Fold this trace into the totals over all traces */
+    for (j = 0; j < 3; j++) {
+	for (k = 0; k < LAT_BUCKETS; k++)
+	    lat_total[j].counts[k] += hists[j].counts[k];
+	lat_total[j].n += hists[j].n;
+	if (hists[j].max > lat_total[j].max)
+	    lat_total[j].max = hists[j].max;
+    }
+
+    sprintf(label, "trace %d", tracenum);
+    print_latency(label, hists);
+}
+
+/*
+ * batch_end - Return the end of the batch that starts at request i:
+ *     up to BATCH_MAX allocs of one size in a row, up to BATCH_MAX
+ *     frees in a row, or a single realloc
+ */
+static int batch_end(trace_t *trace, int i)
+{
+    traceop_t *op = &trace->ops[i];
+    int j = i + 1;
+
+    if (op->type == REALLOC)
+	return j;
+    while (j < trace->num_ops && j - i < BATCH_MAX &&
+	   trace->ops[j].type == op->type &&
+	   (op->type == FREE || trace->ops[j].size == op->size))
+	j++;
+    return j;
+}
+
+/*
+ * batch_replay - Replay the trace with each batch of allocs turned into
+ *     one mm_malloc_batch call and each batch of frees into one
+ *     mm_free_bulk call, and count the calls in *calls. With a range
+ *     tree the blocks are checked as in eval_mm_valid, and a block must
+ *     still hold its data when it is freed. Returns 1 if all went well.
+ */
+static int batch_replay(trace_t *trace, int tracenum, range_t **ranges, 
+			long *calls)
+{
+    void *ptrs[BATCH_MAX];
+    int i, j, k, n, index, size, oldsize;
+    char *p;
+
+    mem_reset_brk();
+    if (ranges != NULL)
+	clear_ranges(ranges);
+    if (mm_init() < 0) 
+	app_error("mm_init failed in batch_replay");
+
+    *calls = 0;
+    for (i = 0;  i < trace->num_ops;  i = j) {
+	j = batch_end(trace, i);
+	n = j - i;
+	size = trace->ops[i].size;
+	(*calls)++;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc_batch */
+	    if (mm_malloc_batch(size, n, ptrs) != (size_t)n) {
+		if (ranges == NULL)
+		    app_error("mm_malloc_batch error in batch_replay");
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    for (k = 0; k < n; k++) {
+		index = trace->ops[i + k].index;
+		p = ptrs[k];
+		if (ranges != NULL) {
+		    if (add_range(ranges, p, size, tracenum, i + k) == 0)
+			return 0;
+		    memset(p, index & 0xFF, size);
+		}
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+	    }
+	    break;
+
+        case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+		if (ranges == NULL)
+		    app_error("mm_realloc error in batch_replay");
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    if (ranges != NULL) {
+		remove_range(ranges, trace->blocks[index]);
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return 0;
+		oldsize = trace->block_sizes[index];
+		if (size < oldsize) oldsize = size;
+		for (k = 0; k < oldsize; k++) {
+		    if ((unsigned char)p[k] != (index & 0xFF)) {
+			malloc_error(tracenum, i, "mm_realloc did not preserve "
+				     "the data from old block");
+			return 0;
+		    }
+		}
+		memset(p, index & 0xFF, size);
+	    }
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* mm_free_bulk */
+	    for (k = 0; k < n; k++) {
+		index = trace->ops[i + k].index;
+		p = trace->blocks[index];
+		if (ranges != NULL) {
+		    for (oldsize = 0; oldsize < (int)trace->block_sizes[index]; oldsize++) {
+			if ((unsigned char)p[oldsize] != (index & 0xFF)) {
+			    malloc_error(tracenum, i + k, "block was overwritten "
+					 "while allocated");
+			    return 0;
+			}
+		    }
+		    remove_range(ranges, p);
+		}
+		ptrs[k] = p;
+	    }
+	    mm_free_bulk(ptrs, n);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in batch_replay");
+        }
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_batch_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the batched replay.
+ */
+static void eval_mm_batch_speed(void *ptr)
+{
+    long calls;
+
+    batch_replay(((speed_t *)ptr)->trace, 0, NULL, &calls);
+}
+
+/*
+ * eval_mm_batch - Check the batched replay of the trace, then time it
+ *     and compare it with secs, the time of the one-call-per-request
+ *     replay.
+ */
+static void eval_mm_batch(trace_t *trace, int tracenum, range_t **ranges, 
+			  double secs)
+{
+    speed_t speed_params;
+    double batch_secs;
+    long calls;
+
+    if (!batch_replay(trace, tracenum, ranges, &calls))
+	return;
+    speed_params.trace = trace;
+    speed_params.ranges = *ranges;
+    batch_secs = fsecs(eval_mm_batch_speed, &speed_params);
+    printf("batch trace %d: %d requests in %ld calls, %.0f Kops (%.0f one by one)\n",
+	   tracenum, trace->num_ops, calls, 
+	   trace->num_ops / 1e3 / batch_secs, trace->num_ops / 1e3 / secs);
+}
+
+static void mt_drain(mt_thread_t *th);
+
+/*
+ * mt_post - Hand block p of size bytes from thread self to its peer,
+ *     which frees it later. A post that would take the mailbox past
+ *     mbox_max bytes makes self wait (draining its own) until the peer
+ *     catches up, so the blocks waiting to be freed stay a small part of
+ *     the trace's heap and a peer that is not scheduled cannot make the
+ *     heap grow without bound.
+ */
+static void mt_post(mt_thread_t *self, char *p, int size)
+{
+    mt_thread_t *th = self->peer;
+
+    pthread_mutex_lock(&th->lock);
+    while (th->mbox_count > 0 && th->mbox_bytes + size > th->mbox_max) {
+	pthread_mutex_unlock(&th->lock);
+	mt_drain(self);
+	sched_yield();
+	pthread_mutex_lock(&th->lock);
+    }
+    if (th->mbox_count == th->mbox_cap) {
+	th->mbox_cap *= 2;
+	if ((th->mbox = realloc(th->mbox, th->mbox_cap * sizeof(char *))) == NULL)
+	    unix_error("realloc failed in mt_post");
+    }
+    th->mbox[th->mbox_count++] = p;
+    th->mbox_bytes += size;
+    pthread_mutex_unlock(&th->lock);
+}
+
+/*
+ * mt_drain - Free the blocks other threads have posted to th. The
+ *     mailbox is swapped for the spare array so that the frees run
+ *     without holding the lock.
+ */
+static void mt_drain(mt_thread_t *th)
+{
+    char **posted;
+    int i, n, cap;
+
+    pthread_mutex_lock(&th->lock);
+    posted = th->mbox;
+    n = th->mbox_count;
+    cap = th->mbox_cap;
+    th->mbox = th->spare;
+    th->mbox_cap = th->spare_cap;
+    th->mbox_count = 0;
+    th->mbox_bytes = 0;
+    pthread_mutex_unlock(&th->lock);
+
+    for (i = 0; i < n; i++)
+	mt_alloc->free_fn(posted[i]);
+    th->spare = posted;
+    th->spare_cap = cap;
+}
+
+/*
+ * mt_worker - Replay one thread's trace MT_REPS times, freeing the
+ *     blocks the trace leaves allocated after each pass
+ */
+static void *mt_worker(void *arg)
+{
+    mt_thread_t *th = (mt_thread_t *)arg;
+    trace_t *trace = th->trace;
+    int rep, i, index, size;
+    char *p;
+
+    pthread_barrier_wait(&mt_start);
+    for (rep = 0; rep < MT_REPS && !th->failed; rep++) {
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    switch (trace->ops[i].type) {
+
+	    case ALLOC:
+		if ((p = mt_alloc->malloc_fn(size)) == NULL)
+		    th->failed = 1;
+		th->blocks[index] = p;
+		th->sizes[index] = size;
+		break;
+
+	    case REALLOC:
+		if ((p = mt_alloc->realloc_fn(th->blocks[index], size)) == NULL)
+		    th->failed = 1;
+		else {
+		    th->blocks[index] = p;
+		    th->sizes[index] = size;
+		}
+		break;
+
+	    case FREE:
+		p = th->blocks[index];
+		th->blocks[index] = NULL;
+		if (mt_cross)
+		    mt_post(th, p, th->sizes[index]);
+		else
+		    mt_alloc->free_fn(p);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in mt_worker");
+	    }
+	    if (th->failed)
+		break;
+	    if (mt_cross && (i & MT_DRAIN_MASK) == 0)
+		mt_drain(th);
+	}
+
+	for (i = 0; i < trace->num_ids; i++) {
+	    if (th->blocks[i]) {
+		mt_alloc->free_fn(th->blocks[i]);
+		th->blocks[i] = NULL;
+	    }
+	}
+    }
+
+    /* 
+     * Keep freeing what the others post until all of them are done too,
+     * so a thread that finishes early does not hold their frees back
+     */
+    __atomic_add_fetch(&mt_finished, 1, __ATOMIC_ACQ_REL);
+    if (mt_cross) {
+	while (__atomic_load_n(&mt_finished, __ATOMIC_ACQUIRE) < mt_nthreads) {
+	    mt_drain(th);
+	    sched_yield();
+	}
+	mt_drain(th);
+    }
+    return NULL;
+}
+
+/*
+ * peak_bytes - Return the largest number of payload bytes the trace
+ *     has allocated at any one time
+ */
+static size_t peak_bytes(trace_t *trace)
+{
+    int *sizes;
+    size_t live = 0, peak = 0;
+    int i, index;
+
+    if ((sizes = calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc failed in peak_bytes");
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	live -= sizes[index];
+	sizes[index] = trace->ops[i].type == FREE ? 0 : trace->ops[i].size;
+	live += sizes[index];
+	if (live > peak)
+	    peak = live;
+    }
+    free(sizes);
+    return peak;
+}
+
+/*
+ * mt_run - Replay traces on nthreads threads at once, thread i taking
+ *     traces[i % num_traces]. Returns the wall clock seconds of the run
+ *     and sets *ops to the number of requests, or returns -1 if some
+ *     request ran out of memory.
+ */
+static double mt_run(trace_t **traces, int num_traces, int nthreads, 
+		     long *ops)
+{
+    mt_thread_t *threads;
+    struct timespec t0, t1;
+    int i, failed = 0;
+
+    if ((threads = calloc(nthreads, sizeof(mt_thread_t))) == NULL)
+	unix_error("calloc failed in mt_run");
+    *ops = 0;
+    for (i = 0; i < nthreads; i++) {
+	mt_thread_t *th = &threads[i];
+
+	th->trace = traces[i % num_traces];
+	th->peer = &threads[(i + 1) % nthreads];
+	th->mbox_cap = th->spare_cap = th->trace->num_ids + 1;
+	th->peer->mbox_max = peak_bytes(th->trace) / MT_MBOX_SHARE;
+	th->blocks = calloc(th->trace->num_ids, sizeof(char *));
+	th->sizes = calloc(th->trace->num_ids, sizeof(int));
+	th->mbox = malloc(th->mbox_cap * sizeof(char *));
+	th->spare = malloc(th->spare_cap * sizeof(char *));
+	if (th->blocks == NULL || th->sizes == NULL || th->mbox == NULL || 
+	    th->spare == NULL)
+	    unix_error("malloc failed in mt_run");
+	pthread_mutex_init(&th->lock, NULL);
+	*ops += (long)th->trace->num_ops * MT_REPS;
+    }
+
+    /* Each run starts from an empty heap with an arena per thread */
+    if (mt_alloc->is_mm) {
+	mem_reset_brk();
+	mm_set_arenas(nthreads, MM_ARENA_ROUND_ROBIN);
+	if (mm_init() < 0)
+	    app_error("mm_init failed in mt_run");
+    }
+
+    mt_nthreads = nthreads;
+    mt_finished = 0;
+    pthread_barrier_init(&mt_start, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++)
+	if (pthread_create(&threads[i].tid, NULL, mt_worker, &threads[i]) != 0)
+	    unix_error("pthread_create failed in mt_run");
+    pthread_barrier_wait(&mt_start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&mt_start);
+
+    for (i = 0; i < nthreads; i++) {
+	failed |= threads[i].failed;
+	pthread_mutex_destroy(&threads[i].lock);
+	free(threads[i].blocks);
+	free(threads[i].sizes);
+	free(threads[i].mbox);
+	free(threads[i].spare);
+    }
+    free(threads);
+
+    if (failed)
+	return -1;
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+ * mt_print - Print one row of the scaling table: the run of ops
+ *     requests on nthreads threads took secs, while one thread would
+ *     have needed serial seconds (negative if unknown)
+ */
+static void mt_print(char *label, int nthreads, long ops, double secs,
+		     double serial)
+{
+    if (secs < 0) {
+	printf("%-6s %7d %10s\n", label, nthreads, "out of mem");
+	return;
+    }
+    printf("%-6s %7d %10.0f", label, nthreads, ops / secs / 1e3);
+    if (serial > 0)
+	printf(" %7.2f %9.0f%%\n", serial / secs, 
+	       100.0 * serial / (nthreads * secs));
+    else
+	printf(" %7s %10s\n", "-", "-");
+}
+
+/*
+ * eval_mt - Replay every trace on 1, 2, 4, ... up to mt_threads threads,
+ *     then all traces together with thread i taking trace i. Scaling
+ *     efficiency compares a run with the time one thread needs for the
+ *     same requests, as measured by the single thread runs. Runs that
+ *     need more than MAX_HEAP bytes show up as "out of mem"; build with
+ *     MEM_VM for more room.
+ */
+static void eval_mt(char **tracefiles, int num_tracefiles, int run_libc)
+{
+    static mt_alloc_t allocs[2] = {
+	{"mm", mm_malloc, mm_free, mm_realloc, 1},
+	{"libc", malloc, free, realloc, 0}
+    };
+    trace_t **traces;
+    double *single, secs, serial;
+    long ops;
+    int a, i, n;
+    char label[MAXLINE];
+
+    traces = malloc(num_tracefiles * sizeof(trace_t *));
+    single = malloc(num_tracefiles * sizeof(double));
+    if (traces == NULL || single == NULL)
+	unix_error("malloc failed in eval_mt");
+    for (i = 0; i < num_tracefiles; i++)
+	traces[i] = read_trace(tracedir, tracefiles[i]);
+
+    for (a = 0; a < (run_libc ? 2 : 1); a++) {
+	mt_alloc = &allocs[a];
+	printf("\nMulti-threaded replay for %s malloc (%d reps, %s frees):\n",
+	       mt_alloc->name, MT_REPS, mt_cross ? "cross-thread" : "local");
+	printf("%-6s %7s %10s %7s %10s\n", 
+	       "trace", "threads", "Kops", "speedup", "efficiency");
+
+	for (i = 0; i < num_tracefiles; i++) {
+	    sprintf(label, "%d", i);
+	    single[i] = -1;
+	    for (n = 1; n <= mt_threads; n = (n < mt_threads && 2*n > mt_threads) ? 
+		     mt_threads : 2*n) {
+		secs = mt_run(&traces[i], 1, n, &ops);
+		if (n == 1)
+		    single[i] = secs;
+		mt_print(label, n, ops, secs, single[i] < 0 ? -1 : n * single[i]);
+	    }
+	}
+
+	/* Every thread on a different trace */
+	for (n = 1; n <= mt_threads; n = (n < mt_threads && 2*n > mt_threads) ? 
+		 mt_threads : 2*n) {
+	    secs = mt_run(traces, num_tracefiles, n, &ops);
+	    serial = 0;
+	    for (i = 0; i < n; i++) {
+		if (single[i % num_tracefiles] < 0) {
+		    serial = -1;
+		    break;
+		}
+		serial += single[i % num_tracefiles];
+	    }
+	    mt_print("mixed", n, ops, secs, serial);
+	}
+    }
+
+    for (i = 0; i < num_tracefiles; i++)
+	free_trace(traces[i]);
+    free(traces);
+    free(single);
+}
+
+/*
+ * grow_worker - Allocate GROW_BLOCK byte blocks until the threads
+ *     together have claimed grow_target bytes, then free them once
+ *     every thread is done. Sets *(int *)arg if mm_malloc fails.
+ */
+static void *grow_worker(void *arg)
+{
+    char **blocks;
+    size_t n = 0, i;
+    char *p;
+
+    if ((blocks = malloc((grow_target / GROW_BLOCK + 1) * sizeof(char *))) == NULL)
+	unix_error("malloc failed in grow_worker");
+    pthread_barrier_wait(&mt_start);
+    while (__atomic_fetch_add(&grow_total, GROW_BLOCK, __ATOMIC_RELAXED) < grow_target) {
+	if ((p = mm_malloc(GROW_BLOCK)) == NULL) {
+	    *(int *)arg = 1;
+	    break;
+	}
+	p[0] = p[GROW_BLOCK - 1] = 1; /* make sure the pages are really there */
+	blocks[n++] = p;
+	sched_yield(); /* interleave the arenas, even on a single CPU */
+    }
+    pthread_barrier_wait(&mt_done); /* keep the heap at its peak until all are done */
+    for (i = 0; i < n; i++)
+	mm_free(blocks[i]);
+    free(blocks);
+    return NULL;
+}
+
+/*
+ * eval_grow - Grow the heap to grow_target bytes from nthreads threads,
+ *     each allocating from its own arena. Arenas that are not at the
+ *     top of the heap open new segments as they grow, so this checks
+ *     that the heap is not limited by how many segments it can track.
+ */
+static void eval_grow(int nthreads)
+{
+    pthread_t *tids;
+    int *failed;
+    int i, fail = 0;
+
+    tids = malloc(nthreads * sizeof(pthread_t));
+    failed = calloc(nthreads, sizeof(int));
+    if (tids == NULL || failed == NULL)
+	unix_error("malloc failed in eval_grow");
+
+    mem_reset_brk();
+    mm_set_arenas(nthreads, MM_ARENA_ROUND_ROBIN);
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_grow");
+    grow_total = 0;
+
+    pthread_barrier_init(&mt_start, NULL, nthreads + 1);
+    pthread_barrier_init(&mt_done, NULL, nthreads);
+    for (i = 0; i < nthreads; i++)
+	if (pthread_create(&tids[i], NULL, grow_worker, &failed[i]) != 0)
+	    unix_error("pthread_create failed in eval_grow");
+    pthread_barrier_wait(&mt_start);
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(tids[i], NULL);
+	fail |= failed[i];
+    }
+    pthread_barrier_destroy(&mt_start);
+    pthread_barrier_destroy(&mt_done);
+
+    if (fail) {
+	errors++;
+	printf("ERROR: mm_malloc failed growing the heap to %lu MB on %d arenas "
+	       "(heap %lu MB)\n", (unsigned long)(grow_target >> 20), nthreads,
+	       (unsigned long)(mem_peak_heapsize() >> 20));
+    }
+    else
+	printf("\nHeap growth: %lu MB on %d arenas ok (heap %lu MB)\n",
+	       (unsigned long)(grow_target >> 20), nthreads,
+	       (unsigned long)(mem_peak_heapsize() >> 20));
+    free(tids);
+    free(failed);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1004,14 +2072,21 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValBLX] [-f <file>] [-t <dir>] [-A <n>] [-F <n>] [-G <n>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <n>     Allocate with mm_memalign(<n>, size) and check the alignment.\n");
+    fprintf(stderr, "\t-B         Replay with mm_malloc_batch and mm_free_bulk as well.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <n>     Print a fragmentation report every <n> ops.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-G <n>     Grow the heap to <n> MB on several arenas.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-request latency percentiles.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay the traces on up to <n> threads.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-X         Free blocks on another thread with -T.\n");
 }
@@ -2,6 +2,12 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            With MEM_VM set in config.h the heap is real virtual memory
+ *            instead: mem_init reserves VM_HEAP bytes of address space
+ *            with mmap(PROT_NONE) and mem_sbrk commits it in
+ *            MEM_COMMIT_CHUNK steps as the brk grows, decommitting it
+ *            again when the brk shrinks.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +16,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,12 +25,27 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_peak_brk;   /* highest brk since the last reset */
+#if MEM_VM
+static char *mem_commit_brk; /* end of the read/write part of the reservation */
+#endif
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
+#if MEM_VM
+    /* reserve address space only, pages are committed by mem_sbrk */
+    mem_start_brk = (char *)mmap(NULL, VM_HEAP, PROT_NONE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == (char *)MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+    mem_commit_brk = mem_start_brk;
+    mem_max_addr = mem_start_brk + VM_HEAP;   /* max legal heap address */
+#else
     /* allocate the storage we will use to model the available VM */
     if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
@@ -31,7 +53,9 @@ void mem_init(void)
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+#endif
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak_brk = mem_start_brk;
 }
 
 /* 
@@ -39,32 +63,82 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+#if MEM_VM
+    munmap(mem_start_brk, VM_HEAP);
+#else
     free(mem_start_brk);
+#endif
 }
 
+#if MEM_VM
+/*
+ * mem_commit - makes [mem_start_brk, brk) read/write, rounding up to
+ *    MEM_COMMIT_CHUNK, and decommits whatever lies above that.
+ *    Returns -1 if the kernel refuses to commit.
+ */
+static int mem_commit(char *brk)
+{
+    uintptr_t chunk = MEM_COMMIT_CHUNK;
+    char *end = (char *)(((uintptr_t)brk + chunk - 1) & ~(chunk - 1));
+
+    if (end > mem_max_addr)
+	end = mem_max_addr;
+    if (end > mem_commit_brk) {
+	if (mprotect(mem_commit_brk, end - mem_commit_brk,
+		     PROT_READ | PROT_WRITE) < 0)
+	    return -1;
+    }
+    else if (end < mem_commit_brk) {
+	/* drop the pages first, PROT_NONE alone would keep them resident */
+	madvise(end, mem_commit_brk - end, MADV_DONTNEED);
+	mprotect(end, mem_commit_brk - end, PROT_NONE);
+    }
+    mem_commit_brk = end;
+    return 0;
+}
+#endif
+
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+    mem_peak_brk = mem_start_brk;
+#if MEM_VM
+    mem_commit(mem_brk);  /* give the old heap's pages back */
+#endif
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, but never below its first byte.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((incr < 0) && (-incr > mem_brk - mem_start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below heap start...\n");
+	return (void *)-1;
+    }
+    if ((incr > 0) && (incr > mem_max_addr - mem_brk)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
+#if MEM_VM
+    if (mem_commit(mem_brk + incr) < 0) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	return (void *)-1;
+    }
+#endif
     mem_brk += incr;
+    if (mem_brk > mem_peak_brk)
+	mem_peak_brk = mem_brk;
     return (void *)old_brk;
 }
 
@@ -92,6 +166,24 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/* 
+ * mem_maxheap() - returns the largest heap size in bytes the backend
+ *    can provide, the heap never leaves [mem_heap_lo, mem_heap_lo + that)
+ */
+size_t mem_maxheap()
+{
+    return (size_t)(mem_max_addr - mem_start_brk);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes
+ *    since mem_init or mem_reset_brk
+ */
+size_t mem_peak_heapsize()
+{
+    return (size_t)(mem_peak_brk - mem_start_brk);
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -1,17 +1,52 @@
-/*
+/* 
  * mm.c - Efficient malloc package implemented using seglists.
  * 
- * My solution ended up being a seglist created on the beginning of the heap.
+ * My solution ended up being a seglist kept next to each arena's heap.
  * The seglist elements hold nodes to unordered linked lists of free blocks.
  * Splitting is done in the function place, and coalescing is done in coalesce.
- * A further challenge would be to implement a buddy system or an ordered list.
- *
+ * Objects of up to SLAB_MAX_SIZE bytes live in page sized slab runs with no
+ * per-object header; a page map tells run objects apart from seglist blocks.
+ * Per-thread caches (tcache) sit in front of the runs, so only refills and
+ * flushes take an arena lock.
+ * Threads are spread over up to MAX_ARENAS arenas, each with its own
+ * buckets, lock and heap segments; frees find the owning arena by address.
+ * Free blocks of TREE_MIN_SIZE bytes and up are kept in a treap ordered by
+ * (size, address) instead, giving address-ordered best fit for large requests.
+ * Memory goes back to the OS in two ways: a large free block at the top of
+ * the heap is trimmed off with a negative mem_sbrk, and the page aligned
+ * interiors of large free blocks are purged with madvise once they have
+ * stayed dirty for the decay time.
+ * Requests of mmap_threshold bytes and more skip the arenas altogether and
+ * get a mapping of their own, which mm_free unmaps and mm_realloc mremaps.
+ * Freed blocks below TREE_MIN_SIZE first sit uncoalesced in exact size fast
+ * bins, where the next request of that size finds them; the bins are
+ * consolidated into the seglist when a request misses or they grow too big.
+ * mm_malloc_batch carves a whole batch of blocks out of a single fit, and
+ * mm_free_bulk frees runs of neighbouring blocks as one block.
+ * mm_free_sized trusts the caller's size: a slab sized request always lives
+ * in a run, so it goes to the thread cache without a page map lookup.
+ * mm_calloc only zeroes what it has to: fresh mappings and purged pages
+ * already read as zero.
+ * mm_memalign carves an aligned block out of a fit with enough slack and
+ * gives the slack on either side back to the seglist.
+ * 
  */
+#define _GNU_SOURCE /* sched_getcpu */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -34,25 +69,118 @@ team_t team = {
 /* Basic constants and macros */
 /* Definitions taken fro CS:APP */
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+/* 16 byte alignment (max_align_t) on 64 bit hosts, 8 on 32 bit hosts,
+   free list links are heap offsets in ALIGNMENT units (1 << LINK_SHIFT) */
+#if UINTPTR_MAX > 0xffffffffu
+#define ALIGNMENT  16
+#define LINK_SHIFT 4
+#else
+#define ALIGNMENT  8
+#define LINK_SHIFT 3
+#endif
 
 #define WSIZE       4       /* Word and header/footer size (bytes) */ 
 #define DSIZE       8       /* Double word size (bytes) */
 #define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */
 
 #define BUCKETS_COUNT 32
-#define OVERHEAD 32
+#define TREE_MIN_SIZE (1<<10) /* Free blocks this large go in the best-fit tree */
+
+/* Smallest block: header, next and prev links, and footer once freed */
+#define MIN_BLOCK_SIZE ALIGN(4*WSIZE)
+
+/* Largest payload a 32 bit header can describe, bigger requests are mmap'ed */
+#define HEAP_REQUEST_MAX ((size_t) 1 << 31)
+
+/* Slab constants */
+#define SLAB_MAX_SIZE   256      /* Largest payload (bytes) served from runs */
+#define SLAB_CLASSES    (UNIT_CLASS(SLAB_MAX_SIZE/ALIGNMENT) + 1) /* Classes served from runs */
+#define RUN_SHIFT       12
+#define RUN_SIZE        (1<<RUN_SHIFT) /* Bytes per run, runs are RUN_SIZE aligned */
+#define RUN_BITMAP_WORDS (RUN_SIZE/ALIGNMENT/32) /* Enough bits for the smallest objects */
+
+/* Page map constants, the map has one byte per RUN_SIZE page of heap */
+#define PAGEMAP_LEAF_BITS 16     /* Pages per leaf: 2^16, covering 256 MB */
+#define PAGEMAP_ROOT_SIZE 1024   /* Leaves in the root, covering 256 GB */
+
+/* Thread cache constants */
+#define TCACHE_FILL     8   /* Objects taken from the runs per refill */
+#define TCACHE_BIN_MAX  16  /* Flush half of a bin once it holds this many */
+
+/* Build with -DCHECK_FREE_SIZE=1 to assert that mm_free_sized gets the right size */
+#ifndef CHECK_FREE_SIZE
+#define CHECK_FREE_SIZE 0
+#endif
+
+/* Fast bin constants */
+#define FASTBINS        (TREE_MIN_SIZE/ALIGNMENT) /* One bin per block size below the tree */
+#define FASTBIN_MAX_BYTES (1<<16) /* Consolidate once the bins hold more than this */
+
+/* Arena constants */
+#define MAX_ARENAS     64       /* Upper bound for mm_set_arenas */
+#define SEGMENTS_INIT  256      /* Entries in the first segment table, doubled when full */
+#define ARENA_CHUNK    (1<<16)  /* Smallest new segment with several arenas */
+
+/* Memory return constants, defaults for mm_set_trim_threshold and mm_set_decay */
+#define TRIM_THRESHOLD  (1<<17)  /* Trim a top free block larger than this */
+#define TRIM_PAD        CHUNKSIZE /* Bytes a trimmed block keeps */
+#define PURGE_DECAY_MS  1000     /* Purge free pages dirty for this long */
+#define PURGE_ADVICE    MADV_DONTNEED /* MADV_FREE is cheaper but keeps old data */
+#define MMAP_THRESHOLD  (1<<20)  /* Default for mm_set_mmap_threshold */
+#define PURGE_ZEROES    (PURGE_ADVICE == MADV_DONTNEED) /* Purged pages read as zero */
+
+/* mm_calloc clears blocks this large with streaming stores, bypassing the cache */
+#define ZERO_STREAM_MIN (1<<18)
+
+/* 
+ * Size classes, shared by the slab runs and the seglist buckets. Sizes
+ * are counted in ALIGNMENT byte units; the first CLASS_STEPS classes are
+ * one unit each, after that every doubling is split into CLASS_STEPS
+ * classes. Build with -DSIZE_CLASS_LG_STEPS=0 for power of two classes,
+ * 1 for two classes per doubling or 2 (default) for four.
+ */
+#ifndef SIZE_CLASS_LG_STEPS
+#define SIZE_CLASS_LG_STEPS 2
+#endif
+#define CLASS_STEPS (1 << SIZE_CLASS_LG_STEPS)
+#define CLASS_COUNT BUCKETS_COUNT /* Entries in class_sizes, a class per bucket */
+#define CLASS_LUT_UNITS 128      /* Entries in class_lut, covers TREE_MIN_SIZE */
+
+/* log2 of the class width in the doubling holding u units, u > CLASS_STEPS */
+#define UNIT_SHIFT(u) (31 - __builtin_clz(((u) - 1) | 1) - SIZE_CLASS_LG_STEPS)
+
+/* Class of a block of u >= 1 units, a constant expression for constant u */
+#define UNIT_CLASS(u) ((u) <= CLASS_STEPS ? (u) - 1 : \
+    ((UNIT_SHIFT(u) + 1) << SIZE_CLASS_LG_STEPS) + (((u) - 1) >> UNIT_SHIFT(u)) - CLASS_STEPS)
+
+/* Largest block of class c in units, 64 bits wide for every layout */
+#define CLASS_UNITS(c) ((c) < CLASS_STEPS ? (c) + 1ULL : \
+    (CLASS_STEPS + (c) % CLASS_STEPS + 1ULL) << ((c) / CLASS_STEPS - 1))
+
+/* Repeat f(i) for 4, 16, 32 or 64 consecutive i, to fill the class tables */
+#define REP4(f, i)  f(i) f((i)+1) f((i)+2) f((i)+3)
+#define REP16(f, i) REP4(f, i) REP4(f, (i)+4) REP4(f, (i)+8) REP4(f, (i)+12)
+#define REP32(f, i) REP16(f, i) REP16(f, (i)+16)
+#define REP64(f, i) REP32(f, i) REP32(f, (i)+32)
+#define LUT_ENTRY(u)  UNIT_CLASS(MAX(u, 1)),
+#define SIZE_ENTRY(c) MIN(CLASS_UNITS(c) * ALIGNMENT, UINT_MAX), /* last bucket is open ended */
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+/* block size needed for a payload of size bytes */
+#define BLOCK_SIZE(size) MAX(ALIGN((size) + WSIZE), MIN_BLOCK_SIZE)
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))  
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) 
+#define PREV_ALLOC 0x2 /* header bit set when the previous block is allocated */
+#define PURGED     0x4 /* free block header bit set once its pages were purged */
+#define MMAPPED    0x4 /* allocated block header bit set for mmap'ed blocks */
 
 /* Read and write a word at address p */
 #define GET(p)       (*(unsigned int *)(p))      
@@ -62,35 +190,266 @@ team_t team = {
 #define GET_SIZE(p)  (GET(p) & ~0x7)            
 #define GET_ALLOC(p) (GET(p) & 0x1)                
 #define GET_ALLOC_PREV(p) (GET(p) & 0x2) // 1 if prev allocated, 0 otherwise
+#define GET_PURGED(p) (GET(p) & PURGED)
+#define GET_MMAPPED(p) (GET(p) & MMAPPED)
+
+/* Given allocated block ptr bp, is it mmap'ed? Checks the address first,
+   since heap headers may be changing under another thread's arena lock */
+#define IN_HEAP(bp)    ((uintptr_t)((char *)(bp) - heap_base) < heap_reserved)
+#define IS_MMAPPED(bp) (!IN_HEAP(bp) && GET_MMAPPED(HDRP(bp)))
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Set or clear the prev allocated bit of the header at address p */
+#define SET_ALLOC_PREV(p)   PUT(p, GET(p) | PREV_ALLOC)
+#define CLEAR_ALLOC_PREV(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and footer,
+   only free blocks have a footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                  
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks,
+   PREV_BLKP is only valid when the previous block is free */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))) 
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Read and write a free list link at address p, see link_get and link_set */
+#define GET_LINK(p)       link_get((char *)(p))
+#define SET_LINK(p, ptr)  link_set((char *)(p), (char *)(ptr))
+
+/* Given free block ptr bp, access its next and prev free list links */
+#define NEXT_FREE(bp)  GET_LINK(bp)
+#define PREV_FREE(bp)  GET_LINK((char *)(bp) + WSIZE)
+#define SET_NEXT_FREE(bp, ptr)  SET_LINK(bp, ptr)
+#define SET_PREV_FREE(bp, ptr)  SET_LINK((char *)(bp) + WSIZE, ptr)
+
+/* An mmap'ed block starts MMAP_HDR_SIZE bytes into its mapping,
+   the first word of the mapping holds the mapping length */
+#define MMAP_HDR_SIZE  ALIGN(sizeof(size_t) + WSIZE)
+#define MMAP_LEN(bp)   (*(size_t *)((char *)(bp) - MMAP_HDR_SIZE))
+
+/* Given free block ptr bp in the tree, access its children (same words as the links) */
+#define LEFT_CHILD(bp)  GET_LINK(bp)
+#define RIGHT_CHILD(bp) GET_LINK((char *)(bp) + WSIZE)
+#define SET_LEFT_CHILD(bp, ptr)  SET_LINK(bp, ptr)
+#define SET_RIGHT_CHILD(bp, ptr) SET_LINK((char *)(bp) + WSIZE, ptr)
+
+/* 
+ * Per-thread cache of free slab objects. Cached objects stay marked in use
+ * in their run's bitmap, so to the arena they look allocated.
+ * bins[i] holds objects of size class i, linked through their
+ * first word. epoch ties the cache to one mm_init.
+ */
+typedef struct {
+    unsigned int epoch;                  /* heap_epoch this cache belongs to */
+    int registered;                      /* destructor installed for thread */
+    void *bins[SLAB_CLASSES];            /* heads of per-class LIFO lists */
+    unsigned int counts[SLAB_CLASSES];   /* objects currently in each bin */
+} tcache_t;
+
+/* 
+ * A run is the payload of one RUN_SIZE aligned seglist block, carved into
+ * objects of a single size class. This header sits at the start of the run
+ * and the objects follow it. Runs that still have free objects are kept on
+ * their arena's per-class list.
+ */
+typedef struct run {
+    struct run *next;                       /* next partial run of the class */
+    struct run *prev;                       /* prev partial run of the class */
+    unsigned int cls;                       /* size class of every object */
+    unsigned int nobjs;                     /* objects in the run */
+    unsigned int nfree;                     /* objects not handed out */
+    unsigned int bitmap[RUN_BITMAP_WORDS];  /* bit i set iff object i is free */
+} run_t;
+
+/* Offset of the first object in a run */
+#define RUN_HDR_SIZE ALIGN(sizeof(run_t))
+
+/* 
+ * An arena is an independent seglist. Its heap is made of one or more
+ * segments, each framed by its own prologue and epilogue so that blocks
+ * never coalesce across arenas.
+ */
+typedef struct {
+    pthread_mutex_t lock;             /* protects everything below */
+    char *buckets[BUCKETS_COUNT];     /* heads of the free lists */
+    unsigned int buckets_map;         /* bit k set iff bucket k is non-empty */
+    char *seg_end;                    /* end of newest segment, 0 if none */
+    run_t *runs[SLAB_CLASSES];        /* runs with free objects, per class */
+    char *tree;                       /* root of the large free block treap */
+    char *fastbins[FASTBINS];         /* freed blocks of each size, still marked allocated */
+    size_t fast_bytes;                /* bytes in the fast bins */
+    char *zero_lo, *zero_hi;          /* pages of the last placed block known to be zero */
+    size_t dirty;                     /* bytes freed into large blocks since purge */
+    long purge_time;                  /* time of the last purge (ms) */
+} arena_t;
+
+/*
+ * Event counters of one thread. Only the owning thread writes them, so
+ * counting needs no lock; mm_stats sums the counters of every thread
+ * whose epoch matches heap_epoch. Exiting threads fold theirs into
+ * counters_retired.
+ */
+typedef struct counters {
+    struct counters *next;        /* next registered thread */
+    int registered;               /* on counters_list */
+    unsigned int epoch;           /* heap_epoch the counts belong to */
+    size_t live_bytes;            /* block bytes handed out minus freed */
+    size_t mmap_bytes;            /* bytes mapped minus unmapped */
+    unsigned long mallocs;
+    unsigned long frees;
+    unsigned long splits;
+    unsigned long coalesces;
+    unsigned long extends;
+    unsigned long realloc_in_place;
+    unsigned long realloc_moves;
+} counters_t;
+
+/* Adds n to counter field of the calling thread */
+#define STAT_ADD(field, n) do { \
+    counters_t *c_ = counters_get(); \
+    __atomic_store_n(&c_->field, c_->field + (n), __ATOMIC_RELAXED); \
+} while (0)
+
+_Static_assert(BUCKETS_COUNT == MM_STATS_BUCKETS, "mm_stats_t needs a slot per bucket");
+
+/* Start of a heap segment and the arena that owns it */
+typedef struct {
+    char *lo;    /* first byte of the segment (alignment padding) */
+    int arena;   /* index into arenas */
+} segment_t;
+
+/* 
+ * The segment table is mmap'ed and replaced by one twice its size when
+ * it fills up. arena_of reads it without a lock, so a replaced table
+ * stays mapped until heap_init, when no thread can be looking at it.
+ */
+typedef struct segtab {
+    struct segtab *old;  /* table this one replaced, or NULL */
+    size_t len;          /* bytes mapped */
+    int cap;             /* entries in seg */
+    segment_t seg[];     /* sorted by address, append only */
+} segtab_t;
+
 /* Function prototypes for internal helper routines */
-static void *extend_heap(size_t words);
-static void *coalesce(void *bp);
-static void buckets_init(unsigned int buckets_count, size_t *starting_position);
-static void *find_bucket(size_t words);
-static void *find_fit(size_t words);
-static void place(void *bp, size_t size);
-static void add_to_bucket(size_t *block, size_t *bucket);
-static void add_to_seglist(size_t *ptr);
-static void remove_from_bucket(size_t *block_ptr, size_t *bucket);
-static void remove_from_seglist(size_t *ptr);
+static int heap_init(void);
+static void heap_lazy_init(void);
+static arena_t *arena_get(void);
+static arena_t *arena_of(void *bp);
+static void *seglist_malloc(arena_t *a, size_t size);
+static void seglist_free(arena_t *a, void *bp);
+static void fastbin_free(arena_t *a, char *bp);
+static void fastbin_consolidate(arena_t *a);
+static int ptr_compare(const void *x, const void *y);
+static void heap_trim(arena_t *a, char *bp);
+static void arena_decay(arena_t *a, char *bp);
+static void purge_block(char *bp);
+static void purge_tree(char *root);
+static long now_ms(void);
+static void *mmap_alloc(size_t size);
+static void *mmap_realloc(char *bp, size_t size);
+static void mmap_free(char *bp);
+static void *seglist_malloc_aligned(arena_t *a, size_t size, size_t align);
+static void zero_block(char *p, size_t n);
+static int slab_class(size_t size);
+static unsigned int pagemap_get(void *ptr);
+static void pagemap_set(void *run, unsigned int val);
+static run_t *run_create(arena_t *a, int cls);
+static int slab_alloc_batch(arena_t *a, int cls, void **out, int n);
+static void slab_free(arena_t *a, char *ptr);
+static inline void tcache_free(unsigned int cls, void *ptr);
+static void block_free(void *ptr);
+static int free_size_ok(void *ptr, size_t size);
+static tcache_t *tcache_get(void);
+static void *tcache_refill(tcache_t *tc, int cls);
+static void tcache_flush(tcache_t *tc, int cls, unsigned int count);
+static void tcache_destroy(void *arg);
+static void tcache_key_create(void);
+static inline counters_t *counters_get(void);
+static void counters_reset(void);
+static void counters_retire(void *arg);
+static void counters_key_create(void);
+static void stats_add(mm_stats_t *stats, counters_t *c);
+static void stats_tree(mm_stats_t *stats, char *root);
+static void *extend_heap(arena_t *a, size_t words);
+static int segments_grow(void);
+static void *coalesce(arena_t *a, void *bp);
+static void buckets_init(arena_t *a);
+static int find_bucket(size_t words);
+static void *find_fit(arena_t *a, size_t words);
+static void place(arena_t *a, void *bp, size_t size);
+static int realloc_in_place(arena_t *a, char *bp, size_t size);
+static inline char *link_get(char *p);
+static inline void link_set(char *p, char *bp);
+static void add_to_bucket(arena_t *a, char *block_ptr, int bucket);
+static void add_to_seglist(arena_t *a, char *ptr);
+static void remove_from_bucket(arena_t *a, char *block_ptr, int bucket);
+static void remove_from_seglist(arena_t *a, char *ptr);
+static char *tree_insert(char *root, char *bp);
+static char *tree_remove(char *root, char *bp);
+static char *tree_merge(char *left, char *right);
+static char *tree_best_fit(char *root, size_t size);
+#ifdef MY_MMTEST
 static void print_seglist(void);
 static void print_heap(void);
+#endif
+static int heap_walk(int (*visit)(char *bp, void *arg), void *arg);
+static int check_block(char *bp, void *arg);
+static int frag_block(char *bp, void *arg);
+static void frag_free(mm_frag_t *frag, size_t size);
+int mm_check(void);
+
+static char *heap_listp = 0; /* prologue of the first segment, 0 until init */
+static char *heap_base = 0;  /* mem_heap_lo, free list links are relative to it */
+static size_t heap_reserved = 0; /* mem_maxheap, no heap block lies beyond */
+static unsigned int heap_epoch = 0; /* bumped by every mm_init */
+
+/* init_lock serializes mm_init, sbrk_lock protects mem_sbrk and segments */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; /* flushes a thread's cache when it exits */
+static __thread tcache_t tcache;
+
+/* stats_lock protects counters_list and counters_retired */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t counters_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t counters_key; /* retires a thread's counters when it exits */
+static __thread counters_t counters;
+static counters_t *counters_list = NULL;  /* counters of live threads */
+static counters_t counters_retired;       /* sum over exited threads */
+
+static arena_t arenas[MAX_ARENAS] = {
+    [0 ... MAX_ARENAS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static int narenas = 1;                           /* arenas in use */
+static int arenas_wanted = 1;                     /* set by mm_set_arenas */
+static int arena_policy = MM_ARENA_ROUND_ROBIN;   /* set by mm_set_arenas */
+static unsigned int arena_next = 0;               /* round robin counter */
+static __thread int arena_ticket = -1;            /* thread's round robin slot */
 
-static char *heap_listp = 0;
+static size_t trim_threshold = TRIM_THRESHOLD;    /* set by mm_set_trim_threshold */
+static long purge_decay_ms = PURGE_DECAY_MS;      /* set by mm_set_decay */
+static size_t mmap_threshold = MMAP_THRESHOLD;    /* set by mm_set_mmap_threshold */
 
-/*
+static segtab_t *segments = NULL; /* grown under sbrk_lock */
+static int segments_count = 0;
+
+/* Largest size of every class, the object size of the slab classes */
+static const unsigned int class_sizes[CLASS_COUNT] = { REP32(SIZE_ENTRY, 0) };
+
+/* Class of a block of u units, for u < CLASS_LUT_UNITS */
+static const unsigned char class_lut[CLASS_LUT_UNITS] = {
+    REP64(LUT_ENTRY, 0) REP64(LUT_ENTRY, 64)
+};
+
+/* Page map: class + 1 of the run on each heap page, 0 for other pages */
+static unsigned char *pagemap[PAGEMAP_ROOT_SIZE];
+static uintptr_t pagemap_base; /* page number of mem_heap_lo */
+
+/* 
  * main - used to test mm.c manually
  */
-// gcc -D MY_MMTEST -Wall -g -m32 mm.c memlib.c -o mymem
+// gcc -D MY_MMTEST -Wall -g -pthread mm.c memlib.c -o mymem
 #ifdef MY_MMTEST
 int main(int argc, char **argv)
 {
@@ -105,339 +464,1734 @@ int main(int argc, char **argv)
   mm_free(ptr3);
 
   mm_check();
+  print_seglist();
   print_heap();
   return 0;
 }
 #endif
 
 /* 
- * mm_init - initialize the malloc package.
- * Implementation partially taken from CS:APP
+ * mm_set_arenas - chooses how many arenas the next mm_init builds and how
+ *                 threads are assigned to them (MM_ARENA_ROUND_ROBIN or
+ *                 MM_ARENA_PER_CPU). Returns -1 on bad arguments.
  */
-int mm_init(void) { 
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) //line:vm:mm:begininit
+int mm_set_arenas(int count, int policy) {
+    if (count < 1 || count > MAX_ARENAS)
+        return -1;
+    if (policy != MM_ARENA_ROUND_ROBIN && policy != MM_ARENA_PER_CPU)
         return -1;
-    buckets_init(BUCKETS_COUNT, (size_t *) (heap_listp));
-    heap_listp += (BUCKETS_COUNT*WSIZE);  
 
-    PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
-    heap_listp += (2*WSIZE);
+    pthread_mutex_lock(&init_lock);
+    arenas_wanted = count;
+    arena_policy = policy;
+    pthread_mutex_unlock(&init_lock);
+    return 0;
+}
+
+/* 
+ * mm_set_trim_threshold - a free block at the top of the heap larger than
+ *                         bytes is shrunk to TRIM_PAD, SIZE_MAX never trims
+ */
+void mm_set_trim_threshold(size_t bytes) {
+    __atomic_store_n(&trim_threshold, bytes, __ATOMIC_RELAXED);
+}
+
+/* 
+ * mm_set_decay - free pages are purged once they stayed dirty for decay_ms,
+ *                0 purges every large block as it is freed, -1 never purges
+ */
+void mm_set_decay(long decay_ms) {
+    __atomic_store_n(&purge_decay_ms, decay_ms, __ATOMIC_RELAXED);
+}
+
+/* 
+ * mm_set_mmap_threshold - requests of bytes and more get their own mapping,
+ *                         SIZE_MAX keeps every request in the arenas
+ */
+void mm_set_mmap_threshold(size_t bytes) {
+    __atomic_store_n(&mmap_threshold, bytes, __ATOMIC_RELAXED);
+}
+
+/* 
+ * mm_stats - fills stats with the allocator's counters, summed over all
+ *            threads, and with the free blocks of every arena
+ *            safe to call at any time, but takes every arena lock in turn
+ */
+void mm_stats(mm_stats_t *stats) {
+    counters_t *c;
+    char *node;
+    int i, k;
+
+    memset(stats, 0, sizeof(*stats));
+    if (heap_listp == 0)
+        return;
+
+    pthread_mutex_lock(&stats_lock);
+    stats_add(stats, &counters_retired);
+    for (c = counters_list; c != NULL; c = c->next)
+        if (__atomic_load_n(&c->epoch, __ATOMIC_RELAXED) == heap_epoch)
+            stats_add(stats, c);
+    pthread_mutex_unlock(&stats_lock);
+
+    for (i = 0; i < narenas; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+        for (k = 0; k < BUCKETS_COUNT; k++) {
+            for (node = arenas[i].buckets[k]; node != 0x0; node = NEXT_FREE(node)) {
+                stats->free_bytes[k] += GET_SIZE(HDRP(node));
+                stats->free_blocks[k]++;
+            }
+        }
+        stats_tree(stats, arenas[i].tree);
+        for (k = 0; k < FASTBINS; k++) {
+            for (node = arenas[i].fastbins[k]; node != 0x0; node = NEXT_FREE(node)) {
+                stats->fast_free_bytes += GET_SIZE(HDRP(node));
+                stats->fast_free_blocks++;
+            }
+        }
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+
+    pthread_mutex_lock(&sbrk_lock);
+    stats->heap_size = mem_heapsize();
+    pthread_mutex_unlock(&sbrk_lock);
+}
+
+/*
+ * stats_add - adds the counters of c to stats
+ */
+static void stats_add(mm_stats_t *stats, counters_t *c) {
+    stats->live_bytes += __atomic_load_n(&c->live_bytes, __ATOMIC_RELAXED);
+    stats->mmap_bytes += __atomic_load_n(&c->mmap_bytes, __ATOMIC_RELAXED);
+    stats->mallocs += __atomic_load_n(&c->mallocs, __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+    stats->splits += __atomic_load_n(&c->splits, __ATOMIC_RELAXED);
+    stats->coalesces += __atomic_load_n(&c->coalesces, __ATOMIC_RELAXED);
+    stats->extends += __atomic_load_n(&c->extends, __ATOMIC_RELAXED);
+    stats->realloc_in_place += __atomic_load_n(&c->realloc_in_place, __ATOMIC_RELAXED);
+    stats->realloc_moves += __atomic_load_n(&c->realloc_moves, __ATOMIC_RELAXED);
+}
+
+/*
+ * stats_tree - counts the free blocks of the treap below root
+ */
+static void stats_tree(mm_stats_t *stats, char *root) {
+    while (root != 0x0) {
+        stats_tree(stats, LEFT_CHILD(root));
+        stats->tree_free_bytes += GET_SIZE(HDRP(root));
+        stats->tree_free_blocks++;
+        root = RIGHT_CHILD(root);
+    }
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ *           thread caches from a previous heap are dropped lazily,
+ *           since heap_epoch no longer matches theirs
+ */
+int mm_init(void) {
+    int ret;
+
+    pthread_mutex_lock(&init_lock);
+    ret = heap_init();
+    pthread_mutex_unlock(&init_lock);
+    return ret;
+}
+
+/* 
+ * heap_lazy_init - builds the heap on the first mm_malloc
+ *                  if nobody called mm_init
+ */
+static void heap_lazy_init(void) {
+    pthread_mutex_lock(&init_lock);
+    if (heap_listp == 0)
+        heap_init();
+    pthread_mutex_unlock(&init_lock);
+}
+
+/* 
+ * heap_init - builds empty arenas, must hold init_lock
+ *             only arena 0 gets memory up front, the others
+ *             grow their first segment on first use
+ */
+static int heap_init(void) {
+    int i;
+
+    heap_epoch++; // invalidates every thread cache and counter
+    heap_listp = 0;
+    pthread_mutex_lock(&stats_lock);
+    memset(&counters_retired, 0, sizeof(counters_retired));
+    counters_retired.epoch = heap_epoch;
+    pthread_mutex_unlock(&stats_lock);
+    segments_count = 0;
+    while (segments != NULL && segments->old != NULL) { // tables replaced by the old heap
+        segtab_t *old = segments->old;
+        segments->old = old->old;
+        munmap(old, old->len);
+    }
+    heap_base = mem_heap_lo();
+    heap_reserved = mem_maxheap();
+    pagemap_base = (uintptr_t) mem_heap_lo() >> RUN_SHIFT;
+    for (i = 0; i < PAGEMAP_ROOT_SIZE; i++) // forget runs of the old heap
+        if (pagemap[i] != NULL)
+            memset(pagemap[i], 0, 1 << PAGEMAP_LEAF_BITS);
+    narenas = arenas_wanted;
+    for (i = 0; i < narenas; i++)
+        buckets_init(&arenas[i]);
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) 
+    if (extend_heap(&arenas[0], CHUNKSIZE/WSIZE) == NULL)
         return -1;
 
+    heap_listp = segments->seg[0].lo + DSIZE; // prologue block of arena 0
     return 0;
 }
 
-/*
- * buckets_init - Initializes buckets_count buckets at beginning of heap
+/* 
+ * buckets_init - Initializes the buckets of arena a, all empty
  * buckets store addresses to head nodes of free linked lists
- * Bucket boundaries are organized as such (ranges inclusive, in bytes):
- *
- * 0x0 : 1        k: 0
- * 0x4 : 2        k: 1
- * 0x8 : 3 - 4    k: 2
- * 0x12: 5 - 8    k: 3
- * 0x16: 9 - 16   k: 4
- * 0x20: 17 - 32  k: 5
- *
+ * Bucket k holds the blocks of size class k, so with the default four
+ * classes per doubling and 16 byte alignment (ranges inclusive, in bytes):
+ * 
+ * 16             k: 0
+ * 32             k: 1
+ * ...
+ * 128            k: 7
+ * 129 - 160      k: 8
+ * 161 - 192      k: 9
+ * ...
+ * 897 - 1008     k: 19   (larger blocks live in the tree)
+ * 
  * IMPORTANT NOTE: the bucket ranges are in total free bytes,
  *                 to find a fit for payload size x:
- *                 BUCKET.LOW <= x + 4*WSIZE <= BUCKET.HIGH
- *                 the 4 represent header, footer, next, and padding of allocated block
+ *                 BUCKET.LOW <= x + WSIZE <= BUCKET.HIGH
+ *                 the WSIZE is the header, the only overhead of an allocated block
+ */
+static void buckets_init(arena_t *a) {
+    memset(a->buckets, 0, sizeof(a->buckets)); // 0 means bucket is empty
+    memset(a->runs, 0, sizeof(a->runs));
+    memset(a->fastbins, 0, sizeof(a->fastbins));
+    a->fast_bytes = 0;
+    a->tree = 0;
+    a->buckets_map = 0;
+    a->seg_end = 0; // no segment yet
+    a->dirty = 0;
+    a->purge_time = now_ms();
+}
+
+/* 
+ * arena_get - picks the arena the calling thread allocates from
  */
-static void buckets_init(unsigned int buckets_count, size_t *starting_position) {
-    mem_sbrk(WSIZE * BUCKETS_COUNT); // makes room for buckets
+static arena_t *arena_get(void) {
+    int cpu;
+
+    if (narenas == 1)
+        return &arenas[0];
+
+    if (arena_policy == MM_ARENA_PER_CPU && (cpu = sched_getcpu()) >= 0)
+        return &arenas[cpu % narenas];
+
+    if (arena_ticket < 0) // first allocation on this thread, take a slot
+        arena_ticket = __atomic_fetch_add(&arena_next, 1, __ATOMIC_RELAXED) & INT_MAX;
+    return &arenas[arena_ticket % narenas];
+}
 
-    // initialize bucket array
-    size_t *bucket = starting_position; // initializes bucket array to start of heap
-    while (buckets_count != 0) {
-      *bucket = 0; // 0 means bucket is empty
-      bucket++; // increment current bucket
-      buckets_count--;
+/* 
+ * arena_of - returns the arena owning block bp by binary searching
+ *            for the last segment that starts at or below bp
+ */
+static arena_t *arena_of(void *bp) {
+    int lo = 0;
+    int hi = __atomic_load_n(&segments_count, __ATOMIC_ACQUIRE) - 1;
+    segtab_t *tab = __atomic_load_n(&segments, __ATOMIC_ACQUIRE); // holds at least hi + 1
+    int mid;
+
+    if (narenas == 1)
+        return &arenas[0];
+
+    while (lo < hi) { // invariant: tab->seg[lo].lo <= bp
+        mid = (lo + hi + 1) / 2;
+        if (tab->seg[mid].lo <= (char *) bp)
+            lo = mid;
+        else
+            hi = mid - 1;
     }
+    return &arenas[tab->seg[lo].arena];
 }
 
 /* 
- * extend_heap - Extend heap with free block and return its block pointer
+ * extend_heap - Extend heap of arena a with free block and return its block pointer
+ *               grows the arena's newest segment in place when it still ends
+ *               at the brk, otherwise starts a new segment with its own
+ *               prologue and epilogue
  *               implementation partly taken from CS:APP
  */
-static void *extend_heap(size_t words) 
+static void *extend_heap(arena_t *a, size_t words)
 {
     char *bp;
+    char *seg;
     size_t size;
-
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-    if ((long)(bp = mem_sbrk(size)) == -1)  
-        return NULL;                      
+    unsigned int prev_alloc; // prev allocated bit of the new block
+
+    /* Allocate a multiple of ALIGNMENT bytes to maintain alignment */
+    size = ALIGN(words * WSIZE);
+
+    pthread_mutex_lock(&sbrk_lock);
+    if (a->seg_end != 0 && a->seg_end == (char *) mem_heap_hi() + 1) {
+        /* New block takes the place of the old epilogue */
+        if ((long)(bp = mem_sbrk(size)) == -1) {
+            pthread_mutex_unlock(&sbrk_lock);
+            return NULL;
+        }
+        prev_alloc = GET_ALLOC_PREV(HDRP(bp));
+    }
+    else {
+        if (narenas > 1) // amortize segment overhead between arenas
+            size = MAX(size, ARENA_CHUNK);
+        if (segments_grow() < 0 ||
+            (long)(seg = mem_sbrk(size + 2*DSIZE)) == -1) {
+            pthread_mutex_unlock(&sbrk_lock);
+            return NULL;
+        }
+        PUT(seg, 0);                          /* Alignment padding */
+        PUT(seg + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+        PUT(seg + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+        bp = seg + 2*DSIZE;
+        prev_alloc = PREV_ALLOC; // prologue is allocated
+
+        segments->seg[segments_count].lo = seg;
+        segments->seg[segments_count].arena = a - arenas;
+        __atomic_store_n(&segments_count, segments_count + 1, __ATOMIC_RELEASE);
+    }
+    a->seg_end = bp + size;
+    pthread_mutex_unlock(&sbrk_lock);
+    STAT_ADD(extends, 1);
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */  
+    PUT(HDRP(bp), PACK(size, prev_alloc)); /* Free block header */
     PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */  
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */ 
 
     /* Coalesce if the previous block was free */
-    return coalesce(bp);                     
+    return coalesce(a, bp);
+}
+
+/* 
+ * segments_grow - makes room for one more segment, moving the table to
+ *                 a mapping twice its size when it is full. The new table
+ *                 is published before segments_count grows past the old
+ *                 one. must hold sbrk_lock, returns -1 if out of memory
+ */
+static int segments_grow(void)
+{
+    segtab_t *tab;
+    int cap = segments != NULL ? 2 * segments->cap : SEGMENTS_INIT;
+    size_t len = sizeof(segtab_t) + cap * sizeof(segment_t);
+
+    if (segments != NULL && segments_count < segments->cap)
+        return 0;
+    tab = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (tab == MAP_FAILED)
+        return -1;
+    tab->old = segments;
+    tab->len = len;
+    tab->cap = cap;
+    if (segments != NULL)
+        memcpy(tab->seg, segments->seg, segments_count * sizeof(segment_t));
+    __atomic_store_n(&segments, tab, __ATOMIC_RELEASE);
+    return 0;
 }
 
 /* 
  * mm_malloc - Allocate a block with at least size bytes of payload 
- *             implementation partly taken from CS:APP
+ *             small blocks come from the calling thread's cache and
+ *             only take an arena lock when the cache has to be refilled
  */
 void *mm_malloc(size_t size) {
-    size_t newsize = ALIGN(size + OVERHEAD); /* Adjusted block size in bytes */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;      
+    size_t newsize = BLOCK_SIZE(size); /* Adjusted block size in bytes */
+    tcache_t *tc;
+    arena_t *a;
+    void **bin;
+    char *bp;
+    int cls;
 
     if (heap_listp == 0) {
-        mm_init();
+        heap_lazy_init();
     }
 
     /* Ignore spurious requests */
     if (size == 0)
-        return NULL;
+        return NULL;                      
 
-    /* Search the free list for a fit */
-    if ((bp = find_fit(newsize / WSIZE)) != NULL) {
-        place(bp, newsize);
-        return bp + DSIZE;
+    if (size <= SLAB_MAX_SIZE) { // fast path, no locking
+        tc = tcache_get();
+        cls = slab_class(size);
+        bin = &tc->bins[cls];
+        if (*bin != NULL) { // pop most recently freed object
+            bp = *bin;
+            *bin = *(void **) bp;
+            tc->counts[cls]--;
+        }
+        else if ((bp = tcache_refill(tc, cls)) == NULL)
+            return NULL;
+        STAT_ADD(mallocs, 1);
+        STAT_ADD(live_bytes, class_sizes[cls]);
+        return bp;
     }
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(newsize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
+    if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) || size > HEAP_REQUEST_MAX) {
+        if ((bp = mmap_alloc(size)) == NULL)
+            return NULL;
+        STAT_ADD(mallocs, 1);
+        STAT_ADD(mmap_bytes, MMAP_LEN(bp));
+        return bp;
+    }
+
+    a = arena_get();
+    pthread_mutex_lock(&a->lock);
+    bp = seglist_malloc(a, newsize);
+    if (bp != NULL) // neighbours rewrite the header once the lock is gone
+        newsize = GET_SIZE(HDRP(bp));
+    pthread_mutex_unlock(&a->lock);
+    if (bp == NULL)
         return NULL;
-    place(bp, newsize);
-    return bp + DSIZE;
+    STAT_ADD(mallocs, 1);
+    STAT_ADD(live_bytes, newsize);
+    return bp;
 }
 
-/*
- * place - handles splitting and block placement
+/* 
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes
+ *             mappings of their own are zero already, and in heap blocks
+ *             only the parts outside pages purged while the block was
+ *             free get cleared
  */
-static void place(void *bp, size_t size)
-{
-    size_t csize = GET_SIZE(HDRP(bp));  // get size  
+void *mm_calloc(size_t nmemb, size_t size) {
+    size_t bytes, newsize;
+    arena_t *a;
+    char *bp, *end;
+    char *lo = NULL, *hi = NULL; // pages of the block known to be zero
 
-    if ((csize - size) >= (4*DSIZE)) { // if possible, split block
-        remove_from_seglist(bp); // remove current block
-        PUT(HDRP(bp), PACK(size, 1)); // allocate bit
-        PUT(FTRP(bp), PACK(size, 1)); // allocate bit
-        bp = NEXT_BLKP(bp);
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+    bytes = nmemb * size;
 
-        PUT(HDRP(bp), PACK(csize-size, 0)); // free other chunk
-        PUT(FTRP(bp), PACK(csize-size, 0)); // free other chunk
-        add_to_seglist(bp); // add to seglist
+    if (bytes <= SLAB_MAX_SIZE) { // recycled objects, always cleared
+        if ((bp = mm_malloc(bytes)) != NULL)
+            memset(bp, 0, bytes);
+        return bp;
     }
-    else {
-        remove_from_seglist(bp); // no splitting, just remove
-        PUT(HDRP(bp), PACK(csize, 1)); // allocate bit
-        PUT(FTRP(bp), PACK(csize, 1)); // allocate bit
+
+    if (heap_listp == 0) {
+        heap_lazy_init();
     }
-}
 
-/*
- * find_bucket - iterates over buckets array to find smallest bucket
- */
-static void *find_bucket(size_t words) {
-  int k; // counter value
-  for (k = 0; k < BUCKETS_COUNT; k++) { // iterates over seglist
-    if (words * WSIZE <= (1 << k)) { // uses shifts to get 2^k and checks size
-      return (size_t *) mem_heap_lo() + k; // return address of bucket if possible
+    if (bytes >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) || bytes > HEAP_REQUEST_MAX) {
+        if ((bp = mmap_alloc(bytes)) == NULL) // fresh anonymous pages
+            return NULL;
+        STAT_ADD(mallocs, 1);
+        STAT_ADD(mmap_bytes, MMAP_LEN(bp));
+        return bp;
     }
-  }
-  return 0; // otherwise, return 0
+
+    a = arena_get();
+    pthread_mutex_lock(&a->lock);
+    bp = seglist_malloc(a, BLOCK_SIZE(bytes));
+    if (bp != NULL) {
+        newsize = GET_SIZE(HDRP(bp));
+        lo = a->zero_lo;
+        hi = a->zero_hi;
+    }
+    pthread_mutex_unlock(&a->lock);
+    if (bp == NULL)
+        return NULL;
+    STAT_ADD(mallocs, 1);
+    STAT_ADD(live_bytes, newsize);
+
+    end = bp + bytes;
+    if (lo < hi && lo < end) { // clear around the zero pages
+        zero_block(bp, lo - bp);
+        if (hi < end)
+            zero_block(hi, end - hi);
+    }
+    else
+        zero_block(bp, bytes);
+    return bp;
 }
 
-/*
- * find_fit - checks first fit inside a given bucket
- *            returns pointer to free block
+/* 
+ * mm_memalign - Allocate a block with at least size bytes of payload at
+ *               an address that is a multiple of alignment, a power of
+ *               two. Blocks come from the heap even above the mmap
+ *               threshold, the slack in front goes back to the seglist
  */
-static void *find_fit(size_t words) {
-  size_t *node;
-  size_t newsize = words;
-  size_t *bucket = (size_t *) find_bucket(newsize); // finds bucket for placement
-  while (bucket < (size_t *) mem_heap_lo() + BUCKETS_COUNT) { // iterates over seglist if no bucket fits
-    node = GET(bucket);
+void *mm_memalign(size_t alignment, size_t size) {
+    size_t newsize = BLOCK_SIZE(size); /* Adjusted block size in bytes */
+    arena_t *a;
+    char *bp;
 
-    while (node != 0x0) { // iterates over linked list
-      if (newsize * WSIZE <= GET_SIZE(HDRP(node))) // if fit found, return
-        return node;
-      node = GET(node); // next node
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= ALIGNMENT) // every block is aligned that far
+        return mm_malloc(size);
+
+    if (heap_listp == 0) {
+        heap_lazy_init();
     }
-    
-    bucket++; // increment bucket
-  }
-  return 0; // no fit found, return 0
+
+    if (size == 0)
+        return NULL;
+    if (alignment > HEAP_REQUEST_MAX / 2 || size > HEAP_REQUEST_MAX - alignment - MIN_BLOCK_SIZE)
+        return NULL; // slack and all would not fit a heap request
+
+    a = arena_get();
+    pthread_mutex_lock(&a->lock);
+    bp = seglist_malloc_aligned(a, newsize, alignment);
+    if (bp != NULL) // neighbours rewrite the header once the lock is gone
+        newsize = GET_SIZE(HDRP(bp));
+    pthread_mutex_unlock(&a->lock);
+    if (bp == NULL)
+        return NULL;
+    STAT_ADD(mallocs, 1);
+    STAT_ADD(live_bytes, newsize);
+    return bp;
 }
 
-/*
- * mm_free - frees a block
+/* 
+ * mm_posix_memalign - posix_memalign on top of mm_memalign, alignment
+ *                     must be a power of two multiple of sizeof(void *)
+ *                     returns 0, EINVAL or ENOMEM
  */
-void mm_free(void *ptr)
-{
-  ptr = ptr - DSIZE; // aligns pointer
-  size_t size = GET_SIZE(HDRP(ptr)); // gets size of block
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *bp;
 
-  PUT(HDRP(ptr), PACK(size, 0)); // zero out alloc bit
-  PUT(FTRP(ptr), PACK(size, 0)); // zero out alloc bit
-
-  coalesce(ptr); // coalesce block if possible
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if (size == 0) { // may be NULL, and mm_free takes no NULL
+        *memptr = NULL;
+        return 0;
+    }
+    if ((bp = mm_memalign(alignment, size)) == NULL)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
 }
 
-/*
- * add_to_bucket - helper method for mm_free
- *                 traverses over linked list and places block
- *                 (so that it keep order max to min)
- *
- *  ______________
- * | size | alloc |
- * |    HEADER    |
- * ----------------
- * |    *next     |  -  0x0 if end of list   <-   node  &  <-  block_ptr
- * |              |
- * ----------------
- * |    *prev     |  -  0x0 if start of list
- * |              |
- * ----------------
- * |              |  -  returned by malloc
- * |   PAYLOAD    |
- * |              |
- * |              |
- * ----------------
- * | size | alloc |  
- * |    FOOTER    |
- * ----------------
- */
-static void add_to_bucket(size_t *block_ptr, size_t *bucket) {
-  size_t *node =  *bucket; // node is now address of first free block, if exists; 
-  PUT(block_ptr, 0x0); // clear next node address
-  PUT(block_ptr + 1, 0x0); // clear prev node address
-
-  if (node == 0x0) { // CASE 1: bucket empty, set bucket content to block_ptr
-    PUT(bucket, block_ptr);
-
-  } else { // CASE 2: else, bucket has blocks already, place at beginning
-    PUT(node + 1, block_ptr); // set prev of node to block
-    PUT(block_ptr, node); // set next of block to node
-    PUT(bucket, block_ptr); // place block in bucket
-  }
+/* 
+ * mm_aligned_alloc - C11 aligned_alloc, size need not be a multiple of
+ *                    alignment (C17 DR 460)
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size) {
+    return mm_memalign(alignment, size);
 }
 
-/*
- * add_to_seglist - container function for
- *                  add_to_bucket
- *
+/* 
+ * zero_block - clears n bytes at p, large ranges with non-temporal
+ *              stores so that they do not flush the cache on the way
  */
-static void add_to_seglist(size_t *ptr) {
-  size_t size = GET_SIZE(HDRP(ptr)); // get size of block
-  add_to_bucket(ptr, find_bucket(size / WSIZE)); // add block to bucket
+static void zero_block(char *p, size_t n) {
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    char *end = p + n;
+    char *q;
+
+    if (n >= ZERO_STREAM_MIN) {
+        q = (char *) (((uintptr_t) p + 15) & ~(uintptr_t) 15);
+        memset(p, 0, q - p);
+        for (; q + 64 <= end; q += 64) {
+            _mm_stream_si128((__m128i *) q, zero);
+            _mm_stream_si128((__m128i *) (q + 16), zero);
+            _mm_stream_si128((__m128i *) (q + 32), zero);
+            _mm_stream_si128((__m128i *) (q + 48), zero);
+        }
+        _mm_sfence(); // order the streaming stores before the block is used
+        memset(q, 0, end - q);
+        return;
+    }
+#endif
+    memset(p, 0, n);
 }
 
-/*
- * remove_from_bucket - helper method that removes and returns free block from bucket
- *                      modifies the linked list
+/* 
+ * mm_malloc_batch - allocates n blocks with at least size bytes of payload
+ *                   each and stores them in out, returns how many it got,
+ *                   fewer than n only when memory runs out
+ *                   seglist blocks are carved from one fit, so a batch
+ *                   takes one lock, one find_fit and one place
  */
-static void remove_from_bucket(size_t *block_ptr, size_t *bucket) {
-  size_t *node;
-  size_t *node2;
-  if (*bucket == block_ptr) { // CASE 1: start of list
-    PUT(bucket, GET(block_ptr)); // set bucket to block
-    node = GET(block_ptr); // node is next of block
-    if (node != 0x0) { // if not 0, block has a next
-        *(node + 1) = 0x0; // set node prev to 0
-      }
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+    size_t bsize = BLOCK_SIZE(size); /* Adjusted block size in bytes */
+    size_t got = 0;
+    size_t count; // blocks carved from the next fit
+    size_t csize, bytes = 0;
+    unsigned int prev_alloc;
+    tcache_t *tc;
+    arena_t *a;
+    void **bin;
+    char *bp;
+    int cls;
 
-  } else { // Case 2: all other cases
-    node = GET(block_ptr + 1); // node is prev
-    if (node != 0x0) { // if not 0, block has a next
-      PUT(node, GET(block_ptr)); // assign previous to point to next
+    if (heap_listp == 0) {
+        heap_lazy_init();
     }
-    node2 = GET(node); // assigns node2 to next
-    if (node2 != 0x0) // if not 0, block has a prev
-      PUT((node2 + 1), node); // connects next to back
-  }
 
-}
+    if (size == 0 || n == 0)
+        return 0;
 
-/*
- * remove_from_seglist - container function for
- *                       remove_from_bucket
- *
- */
-static void remove_from_seglist(size_t *ptr) {
-  size_t size = GET_SIZE(HDRP(ptr)); // get size of block
-  remove_from_bucket(ptr, find_bucket(size / WSIZE)); // remove block from bucket
+    if (size <= SLAB_MAX_SIZE) { // cached objects first, then straight from the runs
+        tc = tcache_get();
+        cls = slab_class(size);
+        bin = &tc->bins[cls];
+        while (got < n && *bin != NULL) {
+            out[got++] = *bin;
+            *bin = *(void **) *bin;
+            tc->counts[cls]--;
+        }
+        if (got < n) {
+            a = arena_get();
+            pthread_mutex_lock(&a->lock);
+            while (got < n && (count = slab_alloc_batch(a, cls, out + got, 
+                                   n - got < INT_MAX ? n - got : INT_MAX)) > 0)
+                got += count;
+            pthread_mutex_unlock(&a->lock);
+        }
+        STAT_ADD(mallocs, got);
+        STAT_ADD(live_bytes, got * class_sizes[cls]);
+        return got;
+    }
+
+    if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) || size > HEAP_REQUEST_MAX) {
+        while (got < n && (out[got] = mm_malloc(size)) != NULL)
+            got++;
+        return got;
+    }
+
+    a = arena_get();
+    pthread_mutex_lock(&a->lock);
+    if (bsize < TREE_MIN_SIZE) { // blocks of this size waiting in the fast bin
+        while (got < n && (bp = a->fastbins[bsize >> LINK_SHIFT]) != NULL) {
+            a->fastbins[bsize >> LINK_SHIFT] = NEXT_FREE(bp);
+            a->fast_bytes -= bsize;
+            bytes += bsize;
+            out[got++] = bp;
+        }
+    }
+    count = HEAP_REQUEST_MAX / bsize;
+    while (got < n) {
+        if (count > n - got)
+            count = n - got;
+        if ((bp = seglist_malloc(a, count * bsize)) == NULL) {
+            if (count == 1)
+                break; // out of memory, return what we have
+            count /= 2; // no room for that many in one piece
+            continue;
+        }
+        csize = GET_SIZE(HDRP(bp));
+        bytes += csize;
+        prev_alloc = GET_ALLOC_PREV(HDRP(bp)); // a fast bin block may follow a free one
+        STAT_ADD(splits, count - 1); // as many splits as placing them one by one
+        while (--count > 0) { // split into blocks of bsize, last one takes the slack
+            PUT(HDRP(bp), PACK(bsize, prev_alloc | 1));
+            prev_alloc = PREV_ALLOC;
+            out[got++] = bp;
+            bp += bsize;
+            csize -= bsize;
+        }
+        PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+        out[got++] = bp;
+        count = n - got;
+    }
+    pthread_mutex_unlock(&a->lock);
+    STAT_ADD(mallocs, got);
+    STAT_ADD(live_bytes, bytes);
+    return got;
 }
 
-/*
- * coalesce - Boundary tag coalescing. Return ptr to coalesced block
- *            Implementation partially taken from CS:APP
- *            removes free blocks from lists as it coalesces
+/* 
+ * seglist_malloc - finds or makes room for a block of size bytes in the
+ *                  seglist of arena a and returns its block pointer,
+ *                  must hold a->lock
+ *                  implementation partly taken from CS:APP
  */
-static void *coalesce(void *bp) {
-	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))); 
-	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp))); 
-	size_t size = GET_SIZE(HDRP(bp));
+static void *seglist_malloc(arena_t *a, size_t size) {
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;
 
-	if(prev_alloc && next_alloc) {			   /* Case 1: both alloced, 
-                                                    only add current to seglist */
-    add_to_seglist(bp); // add block to seglist
-	}
+    a->zero_lo = a->zero_hi = NULL; // set by place
 
-	else if (prev_alloc && ! next_alloc) { /* Case 2: next free, 
-                                                    coalesce and add to seglist */
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp))); // increase size by next
+    /* A block of exactly this size freed lately is ready as it is */
+    if (size < TREE_MIN_SIZE && (bp = a->fastbins[size >> LINK_SHIFT]) != NULL) {
+        a->fastbins[size >> LINK_SHIFT] = NEXT_FREE(bp);
+        a->fast_bytes -= size;
+        return bp;
+    }
 
-    remove_from_seglist( NEXT_BLKP(bp) ); // remove next block from seglist
+    /* Search the free list for a fit, then again with the fast bins merged in */
+    if ((bp = find_fit(a, size / WSIZE)) != NULL ||
+        (a->fast_bytes != 0 && (fastbin_consolidate(a), bp = find_fit(a, size / WSIZE)) != NULL)) {
+        place(a, bp, size);
+        return bp;
+    }
 
-		PUT(HDRP(bp), PACK(size, 0)); // zero out alloc bit
-		PUT(FTRP(bp), PACK(size, 0)); // zero out alloc bit
+    /* No fit found. Get more memory and place the block */
+    extendsize = MAX(size,CHUNKSIZE);
+    if ((bp = extend_heap(a, extendsize/WSIZE)) == NULL)
+        return NULL;                      
+    place(a, bp, size);
+    return bp;
+}
 
-    add_to_seglist(bp); // add coalesced block to seglist
-	}
+/* 
+ * seglist_malloc_aligned - like seglist_malloc, but the returned block
+ *                          pointer is a multiple of align. Takes a block
+ *                          with enough slack and gives the leading and
+ *                          trailing slack back to the seglist.
+ *                          must hold a->lock
+ */
+static void *seglist_malloc_aligned(arena_t *a, size_t size, size_t align) {
+    size_t csize;
+    size_t pad; // size of the block the aligned one is carved from
+    size_t lead; // bytes in front of the aligned block pointer
+    char *bp;
+    char *abp; // aligned block pointer
+
+    /* An aligned block of this size freed lately is ready as it is */
+    if (size < TREE_MIN_SIZE && (bp = a->fastbins[size >> LINK_SHIFT]) != NULL && 
+        ((uintptr_t) bp & (align - 1)) == 0) {
+        a->fastbins[size >> LINK_SHIFT] = NEXT_FREE(bp);
+        a->fast_bytes -= size;
+        return bp;
+    }
 
-	else if (!prev_alloc && next_alloc) {	 /* Case 3: prev free,
-                                                    coalesce and add to seglist */
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))); // increase size by previous
+    /* Ask for just past the largest size of its bucket: any block of the next
+       bucket fits at once, and what is not needed goes back below */
+    pad = size + align + MIN_BLOCK_SIZE;
+    if (pad < TREE_MIN_SIZE)
+        pad = class_sizes[find_bucket(pad / WSIZE)] + ALIGNMENT;
+    if ((bp = seglist_malloc(a, pad)) == NULL)
+        return NULL;                      
 
-    remove_from_seglist( PREV_BLKP(bp) ); // remove prev block from seglist
+    abp = (char *) (((uintptr_t) bp + align - 1) & ~(uintptr_t) (align - 1));
+    while (abp != bp && (size_t) (abp - bp) < MIN_BLOCK_SIZE) // lead must fit a free block
+        abp += align;
 
-		PUT(FTRP(bp), PACK(size, 0)); // zero out alloc bit
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); // zero out alloc bit
-		bp = PREV_BLKP(bp); // change block pointer to previous
+    if ((lead = abp - bp) != 0) { // free the leading slack
+        csize = GET_SIZE(HDRP(bp));
+        PUT(HDRP(bp), PACK(lead, GET_ALLOC_PREV(HDRP(bp)) | 1));
+        PUT(HDRP(abp), PACK(csize - lead, PREV_ALLOC | 1));
+        seglist_free(a, bp);
+    }
+    realloc_in_place(a, abp, size); // shrinking, splits off the trailing slack
+    return abp;
+}
 
-    add_to_seglist(bp); // add coalesced block to seglist
-	}
+/* 
+ * mmap_alloc - maps a block of its own for a payload of size bytes
+ */
+static void *mmap_alloc(size_t size) {
+    size_t page = mem_pagesize();
+    size_t len;
+    char *base;
 
-	else {						                     /* Case 4: both free,
-                                                    coalesce and add to seglist */ 
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp))); 
-    // increase size by previous and next
-    remove_from_seglist( NEXT_BLKP(bp) ); // remove next block from seglist
-    remove_from_seglist( PREV_BLKP(bp) ); // remove prev block from seglist
+    if (size > SIZE_MAX - MMAP_HDR_SIZE - page)
+        return NULL;
+    len = (size + MMAP_HDR_SIZE + page - 1) & ~(page - 1);
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
 
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); // zero out alloc bit
+    *(size_t *) base = len;
+    PUT(base + MMAP_HDR_SIZE - WSIZE, PACK(0, MMAPPED | 1)); // tagged header
+    return base + MMAP_HDR_SIZE;
+}
+
+/* 
+ * mmap_realloc - resizes mmap'ed block bp with mremap, which moves
+ *                the pages instead of copying them if it has to move
+ */
+static void *mmap_realloc(char *bp, size_t size) {
+    size_t page = mem_pagesize();
+    size_t len;
+    char *base;
+
+    if (size > SIZE_MAX - MMAP_HDR_SIZE - page)
+        return NULL;
+    len = (size + MMAP_HDR_SIZE + page - 1) & ~(page - 1);
+    if (len == MMAP_LEN(bp))
+        return bp;
+    base = mremap(bp - MMAP_HDR_SIZE, MMAP_LEN(bp), len, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    *(size_t *) base = len;
+    return base + MMAP_HDR_SIZE;
+}
+
+/* 
+ * mmap_free - unmaps mmap'ed block bp
+ */
+static void mmap_free(char *bp) {
+    munmap(bp - MMAP_HDR_SIZE, MMAP_LEN(bp));
+}
+
+/* 
+ * slab_class - returns the size class for a payload of size bytes
+ */
+static int slab_class(size_t size) {
+    return class_lut[(size + ALIGNMENT - 1) >> LINK_SHIFT];
+}
+
+/* 
+ * pagemap_get - returns class + 1 of the run holding ptr,
+ *               or 0 when ptr is not a slab object
+ */
+static unsigned int pagemap_get(void *ptr) {
+    uintptr_t page = ((uintptr_t) ptr >> RUN_SHIFT) - pagemap_base;
+    unsigned char *leaf;
+
+    if ((page >> PAGEMAP_LEAF_BITS) >= PAGEMAP_ROOT_SIZE)
+        return 0;
+    leaf = __atomic_load_n(&pagemap[page >> PAGEMAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+    return leaf == NULL ? 0 : leaf[page & ((1 << PAGEMAP_LEAF_BITS) - 1)];
+}
+
+/* 
+ * pagemap_set - records val for the page of run,
+ *               mapping a zeroed leaf the first time it is needed
+ */
+static void pagemap_set(void *run, unsigned int val) {
+    uintptr_t page = ((uintptr_t) run >> RUN_SHIFT) - pagemap_base;
+    unsigned char *leaf;
+
+    assert((page >> PAGEMAP_LEAF_BITS) < PAGEMAP_ROOT_SIZE);
+    leaf = pagemap[page >> PAGEMAP_LEAF_BITS];
+    if (leaf == NULL) {
+        pthread_mutex_lock(&sbrk_lock);
+        if ((leaf = pagemap[page >> PAGEMAP_LEAF_BITS]) == NULL) {
+            leaf = mmap(NULL, 1 << PAGEMAP_LEAF_BITS, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            assert(leaf != MAP_FAILED);
+            __atomic_store_n(&pagemap[page >> PAGEMAP_LEAF_BITS], leaf, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&sbrk_lock);
+    }
+    leaf[page & ((1 << PAGEMAP_LEAF_BITS) - 1)] = val;
+}
+
+/* 
+ * run_create - carves a new run for class cls out of the seglist
+ *              and puts it on the arena's partial list, must hold a->lock
+ */
+static run_t *run_create(arena_t *a, int cls) {
+    run_t *run;
+    unsigned int i;
+
+    if ((run = seglist_malloc_aligned(a, BLOCK_SIZE(RUN_SIZE), RUN_SIZE)) == NULL)
+        return NULL;                      
+
+    run->cls = cls;
+    run->nobjs = (RUN_SIZE - RUN_HDR_SIZE) / class_sizes[cls];
+    run->nfree = run->nobjs;
+    memset(run->bitmap, 0, sizeof(run->bitmap));
+    for (i = 0; i < run->nobjs; i++) // every object starts out free
+        run->bitmap[i / 32] |= 1u << (i % 32);
+
+    run->prev = NULL;
+    run->next = a->runs[cls];
+    if (run->next != NULL)
+        run->next->prev = run;
+    a->runs[cls] = run;
+    pagemap_set(run, cls + 1);
+    return run;
+}
+
+/* 
+ * slab_alloc_batch - hands out up to n objects of class cls from the
+ *                    arena's partial runs, creating a run if none is left.
+ *                    Returns the number of objects stored in out.
+ *                    must hold a->lock
+ */
+static int slab_alloc_batch(arena_t *a, int cls, void **out, int n) {
+    run_t *run;
+    unsigned int w, bit;
+    int got = 0;
+
+    while (got < n) {
+        if ((run = a->runs[cls]) == NULL && (run = run_create(a, cls)) == NULL)
+            break; // out of memory, return what we have
+
+        for (w = 0; w < RUN_BITMAP_WORDS && got < n && run->nfree > 0; w++) {
+            while (run->bitmap[w] != 0 && got < n) { // take lowest free objects
+                bit = __builtin_ctz(run->bitmap[w]);
+                run->bitmap[w] &= run->bitmap[w] - 1;
+                run->nfree--;
+                out[got++] = (char *) run + RUN_HDR_SIZE + (w * 32 + bit) * class_sizes[cls];
+            }
+        }
+
+        if (run->nfree == 0) { // run is full, drop it from the partial list
+            a->runs[cls] = run->next;
+            if (run->next != NULL)
+                run->next->prev = NULL;
+        }
+    }
+    return got;
+}
+
+/* 
+ * slab_free - returns object ptr to its run, must hold a->lock
+ *             a run that becomes empty goes back to the seglist,
+ *             unless it is the only partial run of its class
+ */
+static void slab_free(arena_t *a, char *ptr) {
+    run_t *run = (run_t *) ((uintptr_t) ptr & ~(uintptr_t) (RUN_SIZE - 1));
+    unsigned int i = (ptr - (char *) run - RUN_HDR_SIZE) / class_sizes[run->cls];
+
+    run->bitmap[i / 32] |= 1u << (i % 32);
+    if (++run->nfree == 1) { // run was full, make it partial again
+        run->prev = NULL;
+        run->next = a->runs[run->cls];
+        if (run->next != NULL)
+            run->next->prev = run;
+        a->runs[run->cls] = run;
+    }
+    else if (run->nfree == run->nobjs && (run->prev != NULL || run->next != NULL)) {
+        if (run->prev != NULL) // unlink empty run
+            run->prev->next = run->next;
+        else
+            a->runs[run->cls] = run->next;
+        if (run->next != NULL)
+            run->next->prev = run->prev;
+        pagemap_set(run, 0);
+        seglist_free(a, run);
+    }
+}
+
+/* 
+ * tcache_get - returns the calling thread's cache,
+ *              emptying it first if it belongs to an older heap
+ */
+static tcache_t *tcache_get(void) {
+    tcache_t *tc = &tcache;
+
+    if (tc->epoch != heap_epoch) {
+        memset(tc->bins, 0, sizeof(tc->bins)); // blocks of old heap are gone
+        memset(tc->counts, 0, sizeof(tc->counts));
+        tc->epoch = heap_epoch;
+        if (!tc->registered) { // flush this cache when the thread exits
+            pthread_once(&tcache_key_once, tcache_key_create);
+            pthread_setspecific(tcache_key, tc);
+            tc->registered = 1;
+        }
+    }
+    return tc;
+}
+
+/* 
+ * tcache_refill - takes TCACHE_FILL objects of class cls from the runs
+ *                 under a single lock, caches all but one and returns that one
+ */
+static void *tcache_refill(tcache_t *tc, int cls) {
+    void *objs[TCACHE_FILL];
+    arena_t *a = arena_get();
+    int n;
+
+    pthread_mutex_lock(&a->lock);
+    n = slab_alloc_batch(a, cls, objs, TCACHE_FILL);
+    pthread_mutex_unlock(&a->lock);
+    if (n == 0)
+        return NULL;                      
+
+    while (--n > 0) { // cache the rest, lowest address ends up on top
+        *(void **) objs[n] = tc->bins[cls];
+        tc->bins[cls] = objs[n];
+        tc->counts[cls]++;
+    }
+    return objs[0];
+}
+
+/* 
+ * tcache_flush - returns count objects from bin cls back to their runs,
+ *                keeping the current arena locked while consecutive
+ *                objects share it
+ */
+static void tcache_flush(tcache_t *tc, int cls, unsigned int count) {
+    arena_t *locked = NULL;
+    arena_t *a;
+    char *ptr;
+
+    while (count-- > 0 && tc->bins[cls] != NULL) {
+        ptr = tc->bins[cls];
+        tc->bins[cls] = *(void **) ptr;
+        tc->counts[cls]--;
+
+        a = arena_of(ptr);
+        if (a != locked) { // block belongs to another arena, switch locks
+            if (locked != NULL)
+                pthread_mutex_unlock(&locked->lock);
+            pthread_mutex_lock(&a->lock);
+            locked = a;
+        }
+        slab_free(a, ptr);
+    }
+    if (locked != NULL)
+        pthread_mutex_unlock(&locked->lock);
+}
+
+/* 
+ * tcache_destroy - pthread key destructor, hands an exiting thread's
+ *                  cached blocks back to the seglist
+ */
+static void tcache_destroy(void *arg) {
+    tcache_t *tc = arg;
+    int cls;
+
+    if (tc->epoch != heap_epoch) // cache belongs to an older heap
+        return;
+    for (cls = 0; cls < SLAB_CLASSES; cls++)
+        tcache_flush(tc, cls, tc->counts[cls]);
+}
+
+/* 
+ * tcache_key_create - creates tcache_key exactly once
+ */
+static void tcache_key_create(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/* 
+ * counters_get - returns the calling thread's counters,
+ *                zeroing them first if they belong to an older heap
+ */
+static inline counters_t *counters_get(void) {
+    if (counters.epoch != heap_epoch)
+        counters_reset();
+    return &counters;
+}
+
+/*
+ * counters_reset - zeroes the calling thread's counters for the current
+ *                  heap, registering them with mm_stats on first use
+ */
+static void counters_reset(void) {
+    counters_t *c = &counters;
+
+    pthread_mutex_lock(&stats_lock);
+    if (!c->registered) { // retire these counters when the thread exits
+        pthread_once(&counters_key_once, counters_key_create);
+        pthread_setspecific(counters_key, c);
+        c->next = counters_list;
+        counters_list = c;
+        c->registered = 1;
+    }
+    c->live_bytes = c->mmap_bytes = 0;
+    c->mallocs = c->frees = c->splits = c->coalesces = c->extends = 0;
+    c->realloc_in_place = c->realloc_moves = 0;
+    __atomic_store_n(&c->epoch, heap_epoch, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * counters_retire - pthread key destructor, folds an exiting thread's
+ *                   counters into counters_retired
+ */
+static void counters_retire(void *arg) {
+    counters_t *c = arg;
+    counters_t **pp;
+    mm_stats_t sum;
+
+    pthread_mutex_lock(&stats_lock);
+    for (pp = &counters_list; *pp != c; pp = &(*pp)->next)
+        ;
+    *pp = c->next;
+    c->registered = 0;
+    if (c->epoch == counters_retired.epoch) {
+        memset(&sum, 0, sizeof(sum));
+        stats_add(&sum, c);
+        counters_retired.live_bytes += sum.live_bytes;
+        counters_retired.mmap_bytes += sum.mmap_bytes;
+        counters_retired.mallocs += sum.mallocs;
+        counters_retired.frees += sum.frees;
+        counters_retired.splits += sum.splits;
+        counters_retired.coalesces += sum.coalesces;
+        counters_retired.extends += sum.extends;
+        counters_retired.realloc_in_place += sum.realloc_in_place;
+        counters_retired.realloc_moves += sum.realloc_moves;
+    }
+    c->epoch = 0; // counts again from zero if the thread still allocates
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * counters_key_create - creates counters_key exactly once
+ */
+static void counters_key_create(void) {
+    pthread_key_create(&counters_key, counters_retire);
+}
+
+/*
+ * place - handles splitting and block placement
+ *         the previous block of a free block is always allocated,
+ *         so bp and the split off remainder both get PREV_ALLOC
+ */
+static void place(arena_t *a, void *bp, size_t size)
+{
+    size_t csize = GET_SIZE(HDRP(bp));  // get size  
+    uintptr_t page = mem_pagesize();
+
+    if (PURGE_ZEROES && GET_PURGED(HDRP(bp))) { // pages purge_block dropped, for mm_calloc
+        a->zero_lo = (char *) (((uintptr_t) bp + 2*WSIZE + page - 1) & ~(page - 1));
+        a->zero_hi = (char *) ((uintptr_t) MIN(FTRP(bp), (char *) bp + size) & ~(page - 1));
+    }
+
+    if ((csize - size) >= MIN_BLOCK_SIZE) { // if possible, split block
+        STAT_ADD(splits, 1);
+        remove_from_seglist(a, bp); // remove current block
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC | 1)); // allocate bit
+        bp = NEXT_BLKP(bp);
+
+        PUT(HDRP(bp), PACK(csize-size, PREV_ALLOC)); // free other chunk
+        PUT(FTRP(bp), PACK(csize-size, 0)); // free other chunk
+        add_to_seglist(a, bp); // add to seglist
+    }
+    else {
+        remove_from_seglist(a, bp); // no splitting, just remove
+        PUT(HDRP(bp), PACK(csize, PREV_ALLOC | 1)); // allocate bit
+        SET_ALLOC_PREV(HDRP(NEXT_BLKP(bp))); // next block sees bp allocated
+    }
+}
+
+/* 
+ * find_bucket - returns index of the smallest bucket that can hold words,
+ *               the bucket of a block is its size class
+ *               blocks too large for any bucket share the last one
+ */
+static int find_bucket(size_t words) {
+  unsigned int u = (words * WSIZE) >> LINK_SHIFT; // block sizes are whole units
+  int k;
+
+  if (u < CLASS_LUT_UNITS) // every block below TREE_MIN_SIZE
+    return class_lut[u];
+  k = UNIT_CLASS(u);
+  return k < BUCKETS_COUNT ? k : BUCKETS_COUNT - 1;
+}
+
+/* 
+ * find_fit - checks first fit inside a given bucket
+ *            returns pointer to free block
+ *            buckets_map is used to skip straight to non-empty buckets,
+ *            and the tree gives the best fit once the buckets have none
+ */
+static void *find_fit(arena_t *a, size_t words) {
+  char *node;
+  size_t newsize = words;
+  unsigned int candidates; // non-empty buckets that may hold a fit
+  int k = find_bucket(newsize); // finds bucket for placement
+
+  if (newsize * WSIZE >= TREE_MIN_SIZE) // only the tree can fit it
+    return tree_best_fit(a->tree, newsize * WSIZE);
+
+  candidates = a->buckets_map & (~0u << k); // drop buckets that are too small
+
+  while (candidates != 0) { // iterates over non-empty buckets only
+    k = __builtin_ctz(candidates); // lowest populated bucket
+    node = a->buckets[k];
+
+    while (node != 0x0) { // iterates over linked list
+      if (newsize * WSIZE <= GET_SIZE(HDRP(node))) // if fit found, return
+        return node;
+      node = NEXT_FREE(node); // next node
+    }
+
+    candidates &= candidates - 1; // clear bucket k, move on to the next one
+  }
+  return tree_best_fit(a->tree, newsize * WSIZE); // smallest large block, or 0
+}
+
+/* 
+ * mm_free - frees a block
+ *           slab objects go to the calling thread's cache, which spills
+ *           half a bin back to the runs when it fills up
+ */
+void mm_free(void *ptr)
+{
+  unsigned int cls = pagemap_get(ptr); // class + 1, 0 if not in a run
+
+  if (cls != 0) // fast path, no locking and no header read
+    tcache_free(cls - 1, ptr);
+  else
+    block_free(ptr);
+}
+
+/* 
+ * mm_free_sized - frees block ptr of size payload bytes, size being the
+ *                 request that returned ptr. Slab sized requests are
+ *                 always served from runs, so their class comes from size
+ *                 alone, without a page map lookup or a header read.
+ *                 Aligned blocks break this (a small one is a heap block),
+ *                 so they are not accepted; CHECK_FREE_SIZE builds catch
+ *                 them through the page map
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+  if (CHECK_FREE_SIZE)
+    assert(free_size_ok(ptr, size));
+
+  if (size <= SLAB_MAX_SIZE)
+    tcache_free(slab_class(size), ptr);
+  else
+    block_free(ptr);
+}
+
+/* 
+ * free_size_ok - returns 1 if size could have been the request that
+ *                returned block ptr, for CHECK_FREE_SIZE builds
+ */
+static int free_size_ok(void *ptr, size_t size)
+{
+  unsigned int cls = pagemap_get(ptr);
+
+  if (size == 0)
+    return 0;
+  if (size <= SLAB_MAX_SIZE)
+    return cls == (unsigned int) slab_class(size) + 1;
+  if (cls != 0)
+    return 0;
+  if (IS_MMAPPED(ptr))
+    return size <= MMAP_LEN(ptr) - MMAP_HDR_SIZE;
+  return GET_ALLOC(HDRP(ptr)) && BLOCK_SIZE(size) <= GET_SIZE(HDRP(ptr));
+}
+
+/* 
+ * tcache_free - pushes slab object ptr of class cls onto the calling
+ *               thread's cache, which spills half a bin back to the runs
+ *               when it fills up
+ */
+static inline void tcache_free(unsigned int cls, void *ptr)
+{
+  tcache_t *tc = tcache_get();
+
+  STAT_ADD(frees, 1);
+  STAT_ADD(live_bytes, -(size_t) class_sizes[cls]);
+  *(void **) ptr = tc->bins[cls]; // push onto bin, object stays in use
+  tc->bins[cls] = ptr;
+  if (++tc->counts[cls] >= TCACHE_BIN_MAX)
+    tcache_flush(tc, cls, TCACHE_BIN_MAX / 2);
+}
+
+/* 
+ * block_free - frees a block that is not a slab object, either unmapping
+ *              it or handing it back to the arena that owns it
+ */
+static void block_free(void *ptr)
+{
+  arena_t *a;
+  size_t size;
+
+  STAT_ADD(frees, 1);
+  if (IS_MMAPPED(ptr)) { // has a mapping of its own
+    STAT_ADD(mmap_bytes, -MMAP_LEN(ptr));
+    mmap_free(ptr);
+    return;
+  }
+
+  a = arena_of(ptr); // route block back to its owner
+  pthread_mutex_lock(&a->lock);
+  size = GET_SIZE(HDRP(ptr)); // neighbours rewrite our header under the lock
+  if (size < TREE_MIN_SIZE)
+    fastbin_free(a, ptr);
+  else
+    seglist_free(a, ptr);
+  pthread_mutex_unlock(&a->lock);
+  STAT_ADD(live_bytes, -size);
+}
+
+/* 
+ * mm_free_bulk - frees the n blocks in ptrs, skipping NULL entries
+ *                heap blocks are sorted by address, and each run of
+ *                neighbouring blocks goes back to the seglist as one
+ *                block with a single coalesce. ptrs is reordered
+ */
+void mm_free_bulk(void **ptrs, size_t n)
+{
+  arena_t *locked = NULL;
+  arena_t *a;
+  size_t i, j, m = 0;
+  size_t size, bytes = 0;
+  char *bp;
+
+  for (i = 0; i < n; i++) { // slab objects and mappings take the usual way
+    bp = ptrs[i];
+    if (bp == NULL)
+      continue;
+    if (pagemap_get(bp) != 0 || IS_MMAPPED(bp))
+      mm_free(bp);
+    else
+      ptrs[m++] = bp;
+  }
+  qsort(ptrs, m, sizeof(void *), ptr_compare);
+
+  for (i = 0; i < m; i = j) {
+    bp = ptrs[i];
+    a = arena_of(bp);
+    if (a != locked) { // block belongs to another arena, switch locks
+      if (locked != NULL)
+        pthread_mutex_unlock(&locked->lock);
+      pthread_mutex_lock(&a->lock);
+      locked = a;
+    }
+    size = GET_SIZE(HDRP(bp));
+    for (j = i + 1; j < m && (char *) ptrs[j] == bp + size; j++) // neighbours join bp
+      size += GET_SIZE(HDRP(ptrs[j]));
+    bytes += size;
+    if (j == i + 1 && size < TREE_MIN_SIZE)
+      fastbin_free(a, bp);
+    else {
+      PUT(HDRP(bp), PACK(size, GET_ALLOC_PREV(HDRP(bp)) | 1));
+      seglist_free(a, bp);
+    }
+  }
+  if (locked != NULL)
+    pthread_mutex_unlock(&locked->lock);
+  STAT_ADD(frees, m);
+  STAT_ADD(live_bytes, -bytes);
+}
+
+/* 
+ * ptr_compare - qsort comparator, orders pointers by address
+ */
+static int ptr_compare(const void *x, const void *y)
+{
+  uintptr_t p = (uintptr_t) *(void * const *) x;
+  uintptr_t q = (uintptr_t) *(void * const *) y;
+
+  return (p > q) - (p < q);
+}
+
+/* 
+ * seglist_free - marks block bp free and coalesces it into the seglist
+ *                of arena a, must hold a->lock
+ */
+static void seglist_free(arena_t *a, void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp)); // gets size of block
+
+  PUT(HDRP(bp), PACK(size, GET_ALLOC_PREV(HDRP(bp)))); // zero out alloc bit
+  PUT(FTRP(bp), PACK(size, 0)); // free blocks get a footer again
+  CLEAR_ALLOC_PREV(HDRP(NEXT_BLKP(bp))); // next block sees bp free
+
+  bp = coalesce(a, bp); // coalesce block if possible
+  heap_trim(a, bp);
+  arena_decay(a, bp);
+}
+
+/* 
+ * fastbin_free - pushes block bp onto the fast bin of its size without
+ *                touching its neighbours; it stays marked allocated, so
+ *                nothing coalesces with it. must hold a->lock
+ */
+static void fastbin_free(arena_t *a, char *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+
+  SET_NEXT_FREE(bp, a->fastbins[size >> LINK_SHIFT]);
+  a->fastbins[size >> LINK_SHIFT] = bp;
+  a->fast_bytes += size;
+  if (a->fast_bytes > FASTBIN_MAX_BYTES)
+    fastbin_consolidate(a);
+}
+
+/* 
+ * fastbin_consolidate - frees every fast bin block into the seglist,
+ *                       coalescing it with its neighbours. must hold a->lock
+ */
+static void fastbin_consolidate(arena_t *a)
+{
+  char *bp;
+  int k;
+
+  for (k = 0; k < FASTBINS; k++) {
+    while ((bp = a->fastbins[k]) != 0x0) {
+      a->fastbins[k] = NEXT_FREE(bp);
+      seglist_free(a, bp);
+    }
+  }
+  a->fast_bytes = 0;
+}
+
+/* 
+ * heap_trim - gives the tail of free block bp back with a negative mem_sbrk
+ *             when bp is larger than trim_threshold and ends the heap,
+ *             must hold a->lock
+ */
+static void heap_trim(arena_t *a, char *bp) {
+  size_t size = GET_SIZE(HDRP(bp));
+  size_t release;
+
+  if (size <= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED) || size <= TRIM_PAD)
+    return;
+  if (NEXT_BLKP(bp) != a->seg_end) // not the last block of the newest segment
+    return;
+  release = (size - TRIM_PAD) & ~(mem_pagesize() - 1); // keeps the brk page aligned
+  if (release == 0)
+    return;
+
+  pthread_mutex_lock(&sbrk_lock);
+  if (a->seg_end != (char *) mem_heap_hi() + 1 || mem_sbrk(-(intptr_t) release) == (void *) -1) {
+    pthread_mutex_unlock(&sbrk_lock); // another arena grew past us
+    return;
+  }
+  remove_from_seglist(a, bp);
+  size -= release;
+  a->seg_end -= release;
+  pthread_mutex_unlock(&sbrk_lock);
+
+  PUT(HDRP(bp), PACK(size, GET_ALLOC_PREV(HDRP(bp))));
+  PUT(FTRP(bp), PACK(size, 0));
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // new epilogue, previous block free
+  add_to_seglist(a, bp);
+}
+
+/* 
+ * arena_decay - counts free block bp as dirty and purges the arena once
+ *               purge_decay_ms went by since the last purge,
+ *               must hold a->lock
+ */
+static void arena_decay(arena_t *a, char *bp) {
+  long decay = __atomic_load_n(&purge_decay_ms, __ATOMIC_RELAXED);
+  long now;
+
+  if (decay < 0 || GET_SIZE(HDRP(bp)) < TREE_MIN_SIZE)
+    return;
+  if (decay == 0) { // eager, only bp can be dirty
+    purge_block(bp);
+    return;
+  }
+
+  a->dirty += GET_SIZE(HDRP(bp));
+  if (a->dirty < 2 * mem_pagesize()) // not a single whole page to give back yet
+    return;
+  now = now_ms();
+  if (now - a->purge_time < decay)
+    return;
+  purge_tree(a->tree);
+  a->dirty = 0;
+  a->purge_time = now;
+}
+
+/* 
+ * purge_block - releases the whole pages inside free block bp,
+ *               its header, links and footer stay in place
+ */
+static void purge_block(char *bp) {
+  uintptr_t page = mem_pagesize();
+  uintptr_t lo = ((uintptr_t) bp + 2*WSIZE + page - 1) & ~(page - 1);
+  uintptr_t hi = (uintptr_t) FTRP(bp) & ~(page - 1);
+
+  if (GET_PURGED(HDRP(bp)))
+    return; // still clean since the last purge
+  if (hi > lo)
+    madvise((void *) lo, hi - lo, PURGE_ADVICE);
+  PUT(HDRP(bp), GET(HDRP(bp)) | PURGED); // any rewrite of the header marks it dirty
+}
+
+/* 
+ * purge_tree - purges every block of the large free block treap below root
+ */
+static void purge_tree(char *root) {
+  while (root != 0x0) {
+    purge_tree(LEFT_CHILD(root));
+    purge_block(root);
+    root = RIGHT_CHILD(root);
+  }
+}
+
+/* 
+ * now_ms - monotonic clock in milliseconds
+ */
+static long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* 
+ * link_get - decodes the link word at p, 0 encodes a null link
+ *            since no block starts at heap_base
+ */
+static inline char *link_get(char *p) {
+  unsigned int off = GET(p);
+  return off ? heap_base + ((uintptr_t) off << LINK_SHIFT) : 0x0;
+}
+
+/*
+ * link_set - stores bp as an offset from heap_base in ALIGNMENT units,
+ *            so 32 bits reach 2^32 * ALIGNMENT bytes of heap
+ */
+static inline void link_set(char *p, char *bp) {
+  PUT(p, bp ? (unsigned int) ((uintptr_t) (bp - heap_base) >> LINK_SHIFT) : 0);
+}
+
+/*
+ * add_to_bucket - helper method for mm_free
+ *                 places block at the beginning of the bucket's list
+ * 
+ *  _____________________
+ * | size | prev | alloc |
+ * |       HEADER        |
+ * -----------------------
+ * |     next     |  -  0x0 if end of list   <-   node  &  <-  block_ptr
+ * |              |          (allocated: payload returned by malloc starts here)
+ * -----------------------
+ * |     prev     |  -  0x0 if start of list
+ * |              |     (both links are 32 bit offsets, see link_set)
+ * -----------------------
+ * |              |
+ * |   (unused)   |
+ * |              |
+ * -----------------------
+ * | size | 0 | 0 |  -  free blocks only, allocated
+ * |    FOOTER    |     blocks carry just the header
+ * -----------------------
+ */
+static void add_to_bucket(arena_t *a, char *block_ptr, int bucket) {
+  char *node = a->buckets[bucket]; // node is now address of first free block, if exists
+  SET_NEXT_FREE(block_ptr, node); // next of block is old first node (or 0x0)
+  SET_PREV_FREE(block_ptr, 0x0); // block becomes start of list
+
+  if (node != 0x0) // bucket has blocks already, link old first node back
+    SET_PREV_FREE(node, block_ptr);
+  a->buckets[bucket] = block_ptr; // place block in bucket
+  a->buckets_map |= 1u << bucket; // mark bucket non-empty
+}
+
+/* 
+ * add_to_seglist - container function for
+ *                  add_to_bucket and tree_insert
+ * 
+ */
+static void add_to_seglist(arena_t *a, char *ptr) {
+  size_t size = GET_SIZE(HDRP(ptr)); // get size of block
+  if (size >= TREE_MIN_SIZE)
+    a->tree = tree_insert(a->tree, ptr); // large blocks go in the tree
+  else
+    add_to_bucket(a, ptr, find_bucket(size / WSIZE)); // add block to bucket
+}
+
+/* 
+ * remove_from_bucket - helper method that removes and returns free block from bucket
+ *                      modifies the linked list
+ */
+static void remove_from_bucket(arena_t *a, char *block_ptr, int bucket) {
+  char *next = NEXT_FREE(block_ptr);
+  char *prev = PREV_FREE(block_ptr);
+
+  if (prev == 0x0) { // CASE 1: start of list
+    a->buckets[bucket] = next; // set bucket to next of block
+    if (next == 0x0) // bucket is now empty
+      a->buckets_map &= ~(1u << bucket);
+  } else { // Case 2: all other cases
+    SET_NEXT_FREE(prev, next); // assign previous to point to next
+  }
+
+  if (next != 0x0) // if not 0, block has a next
+    SET_PREV_FREE(next, prev); // connects next to back
+}
+
+/* 
+ * remove_from_seglist - container function for
+ *                       remove_from_bucket and tree_remove
+ *                       the header must still hold the size ptr was added with
+ */
+static void remove_from_seglist(arena_t *a, char *ptr) {
+  size_t size = GET_SIZE(HDRP(ptr)); // get size of block
+  if (size >= TREE_MIN_SIZE)
+    a->tree = tree_remove(a->tree, ptr);
+  else
+    remove_from_bucket(a, ptr, find_bucket(size / WSIZE)); // remove block from bucket
+}
+
+/* 
+ * tree_less - orders free blocks by size, then by address
+ */
+static inline int tree_less(char *x, char *y) {
+  size_t xsize = GET_SIZE(HDRP(x));
+  size_t ysize = GET_SIZE(HDRP(y));
+  return xsize < ysize || (xsize == ysize && x < y);
+}
+
+/* 
+ * tree_priority - heap priority of a treap node, a hash of its address
+ *                 so no extra word has to be stored in the block
+ */
+static inline unsigned int tree_priority(char *bp) {
+  uintptr_t x = (uintptr_t) bp;
+  x ^= x >> 16;
+  x *= 0x45d9f3b;
+  x ^= x >> 16;
+  x *= 0x45d9f3b;
+  x ^= x >> 16;
+  return (unsigned int) x;
+}
+
+/* 
+ * tree_insert - inserts free block bp into the treap rooted at root
+ *               and returns the new root, rotating bp up while its
+ *               priority beats its parent's
+ */
+static char *tree_insert(char *root, char *bp) {
+  char *child;
+
+  if (root == 0x0) { // CASE 1: empty subtree, bp becomes a leaf
+    SET_LEFT_CHILD(bp, 0x0);
+    SET_RIGHT_CHILD(bp, 0x0);
+    return bp;
+  }
+
+  if (tree_less(bp, root)) { // CASE 2: goes left, rotate right if needed
+    SET_LEFT_CHILD(root, tree_insert(LEFT_CHILD(root), bp));
+    child = LEFT_CHILD(root);
+    if (tree_priority(child) > tree_priority(root)) {
+      SET_LEFT_CHILD(root, RIGHT_CHILD(child));
+      SET_RIGHT_CHILD(child, root);
+      return child;
+    }
+  } else { // CASE 3: goes right, rotate left if needed
+    SET_RIGHT_CHILD(root, tree_insert(RIGHT_CHILD(root), bp));
+    child = RIGHT_CHILD(root);
+    if (tree_priority(child) > tree_priority(root)) {
+      SET_RIGHT_CHILD(root, LEFT_CHILD(child));
+      SET_LEFT_CHILD(child, root);
+      return child;
+    }
+  }
+  return root;
+}
+
+/* 
+ * tree_remove - removes free block bp from the treap rooted at root
+ *               and returns the new root
+ */
+static char *tree_remove(char *root, char *bp) {
+  if (root == bp) // found it, its children take its place
+    return tree_merge(LEFT_CHILD(bp), RIGHT_CHILD(bp));
+
+  if (tree_less(bp, root))
+    SET_LEFT_CHILD(root, tree_remove(LEFT_CHILD(root), bp));
+  else
+    SET_RIGHT_CHILD(root, tree_remove(RIGHT_CHILD(root), bp));
+  return root;
+}
+
+/* 
+ * tree_merge - joins two treaps where every block in left
+ *              orders before every block in right
+ */
+static char *tree_merge(char *left, char *right) {
+  if (left == 0x0)
+    return right;
+  if (right == 0x0)
+    return left;
+
+  if (tree_priority(left) > tree_priority(right)) {
+    SET_RIGHT_CHILD(left, tree_merge(RIGHT_CHILD(left), right));
+    return left;
+  }
+  SET_LEFT_CHILD(right, tree_merge(left, LEFT_CHILD(right)));
+  return right;
+}
+
+/* 
+ * tree_best_fit - returns the smallest block of at least size bytes,
+ *                 the lowest addressed one among equal sizes, or 0
+ */
+static char *tree_best_fit(char *root, size_t size) {
+  char *best = 0x0;
+
+  while (root != 0x0) {
+    if (GET_SIZE(HDRP(root)) >= size) { // fits, look for a smaller one
+      best = root;
+      root = LEFT_CHILD(root);
+    } else {
+      root = RIGHT_CHILD(root);
+    }
+  }
+  return best;
+}
+
+/* 
+ * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ *            Implementation partially taken from CS:APP
+ *            removes free blocks from lists as it coalesces
+ *            the prev allocated bit replaces reading the previous footer,
+ *            and a coalesced block always follows an allocated one
+ */
+static void *coalesce(arena_t *a, void *bp) {
+	size_t prev_alloc = GET_ALLOC_PREV(HDRP(bp));
+	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp))); 
+	size_t size = GET_SIZE(HDRP(bp));
+
+	if(prev_alloc && next_alloc) {			   /* Case 1: both alloced, 
+                                                    only add current to seglist */
+    add_to_seglist(a, bp); // add block to seglist
+	} 
+
+	else if (prev_alloc && ! next_alloc) { /* Case 2: next free, 
+                                                    coalesce and add to seglist */ 
+		size += GET_SIZE(HDRP(NEXT_BLKP(bp))); // increase size by next
+    STAT_ADD(coalesces, 1);
+
+    remove_from_seglist(a, NEXT_BLKP(bp) ); // remove next block from seglist
+
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC)); // zero out alloc bit
+		PUT(FTRP(bp), PACK(size, 0)); // zero out alloc bit
+
+    add_to_seglist(a, bp); // add coalesced block to seglist
+	} 
+
+	else if (!prev_alloc && next_alloc) {	 /* Case 3: prev free,
+                                                    coalesce and add to seglist */ 
+		size += GET_SIZE(HDRP(PREV_BLKP(bp))); // increase size by previous
+    STAT_ADD(coalesces, 1);
+
+    remove_from_seglist(a, PREV_BLKP(bp) ); // remove prev block from seglist
+
+		PUT(FTRP(bp), PACK(size, 0)); // zero out alloc bit
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC)); // zero out alloc bit
+		bp = PREV_BLKP(bp); // change block pointer to previous
+
+    add_to_seglist(a, bp); // add coalesced block to seglist
+	} 
+
+	else {						                     /* Case 4: both free,
+                                                    coalesce and add to seglist */ 
+		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp))); 
+    // increase size by previous and next
+    STAT_ADD(coalesces, 2);
+    remove_from_seglist(a, NEXT_BLKP(bp) ); // remove next block from seglist
+    remove_from_seglist(a, PREV_BLKP(bp) ); // remove prev block from seglist
+
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC)); // zero out alloc bit
 		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0)); // zero out alloc bit
 		bp = PREV_BLKP(bp); // change block pointer to previous
 
-    add_to_seglist(bp); // add coalesced block to seglist
+    add_to_seglist(a, bp); // add coalesced block to seglist
 	} 
 	return bp; // return block pointer
 }
 
-/*
- * mm_realloc - Simple implementation of realloc
- *              using mm_malloc and mm_free
+/* 
+ * mm_realloc - resizes the block in place when it can,
+ *              otherwise falls back to mm_malloc, memcpy and mm_free
  */
 void *mm_realloc(void *ptr, size_t size) {
     size_t csize; // current block size
     void *newptr; // new block
+    size_t oldlen; // mapping length of an mmap'ed block
+    size_t newsize; // block size after an in place resize
+    arena_t *a;
+    unsigned int cls;
+    int done;
 
     // if ptr is NULL, the call is equivalent to mm_malloc(size)
     if(ptr == NULL) {
@@ -450,9 +2204,48 @@ void *mm_realloc(void *ptr, size_t size) {
         return 0;
     }
 
-    newptr = mm_malloc(size); // create new block with size size
+    if ((cls = pagemap_get(ptr)) != 0) { // slab object, fine while the class fits
+        if (size <= SLAB_MAX_SIZE && slab_class(size) == cls - 1) {
+            STAT_ADD(realloc_in_place, 1);
+            return ptr;
+        }
+        csize = class_sizes[cls - 1];
+    }
+    else if (IS_MMAPPED(ptr)) { // stays mapped while it is large enough
+        if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) || size > HEAP_REQUEST_MAX) {
+            oldlen = MMAP_LEN(ptr);
+            if ((newptr = mmap_realloc(ptr, size)) == NULL)
+                return NULL;
+            STAT_ADD(mmap_bytes, MMAP_LEN(newptr) - oldlen);
+            if (newptr == ptr)
+                STAT_ADD(realloc_in_place, 1);
+            else
+                STAT_ADD(realloc_moves, 1);
+            return newptr;
+        }
+        csize = MMAP_LEN(ptr) - MMAP_HDR_SIZE;
+    }
+    else {
+        a = arena_of(ptr); // only the owning arena may touch the neighbours
+        pthread_mutex_lock(&a->lock);
+        csize = GET_SIZE(HDRP(ptr));
+        // slab sized requests move to a run, mm_free_sized relies on it
+        done = size > SLAB_MAX_SIZE && size <= HEAP_REQUEST_MAX && 
+            realloc_in_place(a, ptr, BLOCK_SIZE(size));
+        newsize = GET_SIZE(HDRP(ptr));
+        pthread_mutex_unlock(&a->lock);
+        if (done) {
+            STAT_ADD(realloc_in_place, 1);
+            STAT_ADD(live_bytes, newsize - csize);
+            return ptr;
+        }
+        csize -= WSIZE; // payload size
+    }
+
+    if ((newptr = mm_malloc(size)) == NULL) // create new block with size size
+        return NULL;                      
+    STAT_ADD(realloc_moves, 1);
 
-    csize = GET_SIZE(HDRP(ptr - DSIZE)); // locates header and finds size
     if(size < csize) // if requested size is less than current size take max
       csize = size;
     memcpy(newptr, ptr, csize); // copy the data from old to new block
@@ -462,72 +2255,288 @@ void *mm_realloc(void *ptr, size_t size) {
     return newptr;
 }
 
-/*
+/* 
+ * realloc_in_place - resizes allocated block bp to size bytes without
+ *                    moving it, must hold a->lock. Returns 1 on success.
+ *                    Shrinking splits off the tail, growing absorbs a free
+ *                    next block, and a block at the end of the arena's
+ *                    newest segment first grows the heap behind it.
+ */
+static int realloc_in_place(arena_t *a, char *bp, size_t size) {
+    size_t csize = GET_SIZE(HDRP(bp)); // current block size
+    size_t nsize; // size of the free block after bp, 0 if none
+    char *next = NEXT_BLKP(bp);
+    char *end;
+
+    if (size <= csize) { // CASE 1: shrink, or same size
+        if ((csize - size) >= MIN_BLOCK_SIZE) { // split the tail off
+            STAT_ADD(splits, 1);
+            PUT(HDRP(bp), PACK(size, GET_ALLOC_PREV(HDRP(bp)) | 1));
+            next = NEXT_BLKP(bp);
+            PUT(HDRP(next), PACK(csize - size, PREV_ALLOC | 1)); // looks allocated
+            seglist_free(a, next); // ... until freed and coalesced
+        }
+        return 1;
+    }
+
+    nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    end = nsize ? NEXT_BLKP(next) : next; // first block after the free space
+
+    if (csize + nsize < size && GET_SIZE(HDRP(end)) == 0 && end == a->seg_end) {
+        /* CASE 2: bp is last in the newest segment, grow the heap behind it,
+                   by at least a block that can stand on its own */
+        if (extend_heap(a, MAX(size - csize - nsize, MIN_BLOCK_SIZE) / WSIZE) == NULL)
+            return 0;
+        next = NEXT_BLKP(bp); // extend_heap coalesced with any free next
+        nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    }
+
+    if (csize + nsize < size) // not enough room behind bp
+        return 0;
+
+    /* CASE 3: absorb the free next block, giving back what is left */
+    remove_from_seglist(a, next);
+    csize += nsize;
+    if ((csize - size) >= MIN_BLOCK_SIZE) {
+        STAT_ADD(splits, 1);
+        PUT(HDRP(bp), PACK(size, GET_ALLOC_PREV(HDRP(bp)) | 1));
+        next = NEXT_BLKP(bp);
+        PUT(HDRP(next), PACK(csize - size, PREV_ALLOC)); // free other chunk
+        PUT(FTRP(next), PACK(csize - size, 0));
+        add_to_seglist(a, next);
+    }
+    else {
+        PUT(HDRP(bp), PACK(csize, GET_ALLOC_PREV(HDRP(bp)) | 1));
+        SET_ALLOC_PREV(HDRP(NEXT_BLKP(bp))); // next block sees bp allocated
+    }
+    return 1;
+}
+
+#ifdef MY_MMTEST
+/* 
  * print_seglist - prints the current seglist
- *                 by looping over seglist
+ *                 by looping over the buckets of every arena
  */
 static void print_seglist(void) {
-  size_t *current_word = mem_heap_lo(); // initializes current_word at heap start
-  while (current_word <= (size_t *) mem_heap_lo() + BUCKETS_COUNT) { // loops over seglist
-    printf("             --------------\n"); // upper border
-    printf("%p  |  0x%x\n", current_word, *current_word); // prints address and content
-    printf("             --------------\n"); // lower border
-    current_word++; // increments address
+  int i, k;
+  for (i = 0; i < narenas; i++) { // loops over arenas
+    printf("arena %d\n", i);
+    for (k = 0; k < BUCKETS_COUNT; k++) { // loops over seglist
+      printf("             --------------\n"); // upper border
+      printf("%2d  |  %p\n", k, arenas[i].buckets[k]); // prints bucket and head
+      printf("             --------------\n"); // lower border
+    }
+    printf("tree  |  %p\n", arenas[i].tree); // prints root of the large block tree
   }
 }
 
-/*
+/* 
  * print_heap - prints entire heap
  */
 static void print_heap(void) {
   size_t *current_word = mem_heap_lo();
-  while (current_word <= mem_heap_hi()) {
+  while ((char *) current_word <= (char *) mem_heap_hi()) {
     printf("             --------------\n"); // upper border
-    printf("%p  |  0x%x\n", current_word, *current_word);
+    printf("%p  |  0x%zx\n", (void *) current_word, *current_word);
     printf("             --------------\n"); // lower border
     current_word++;
   }
 }
+#endif
 
-/*
+/* 
+ * tree_check - returns 1 if every block below root is free, large enough
+ *              for the tree and ordered strictly between lo and hi
+ */
+static int tree_check(char *root, char *lo, char *hi) {
+  if (root == 0x0)
+    return 1;
+  if (GET_ALLOC(HDRP(root)) || GET_SIZE(HDRP(root)) < TREE_MIN_SIZE)
+    return 0;
+  if ((lo != 0x0 && !tree_less(lo, root)) || (hi != 0x0 && !tree_less(root, hi)))
+    return 0;
+  return tree_check(LEFT_CHILD(root), lo, root) && tree_check(RIGHT_CHILD(root), root, hi);
+}
+
+/* 
+ * heap_walk - calls visit on every block of every segment, from the
+ *             first block after the prologue up to the epilogue, and
+ *             stops as soon as visit returns 0. Returns 0 iff it stopped.
+ *             the caller keeps the arenas from changing
+ */
+static int heap_walk(int (*visit)(char *bp, void *arg), void *arg) {
+  int n = __atomic_load_n(&segments_count, __ATOMIC_ACQUIRE);
+  char *bp;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    for (bp = NEXT_BLKP(segments->seg[i].lo + DSIZE); GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp))
+      if (!visit(bp, arg))
+        return 0;
+  }
+  return 1;
+}
+
+/* 
+ * check_block - heap_walk visitor for mm_check
+ */
+static int check_block(char *bp, void *arg) {
+  /* 1. Checks whether free headers and footer match, and prev allocated bits */
+  if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) != GET(FTRP(bp))) {
+    printf("ERROR: header and footer do not match!\n");
+    return 0;
+  }
+  if (!GET_ALLOC_PREV(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp))) {
+    printf("ERROR: prev allocated bit is stale!\n");
+    return 0;
+  }
+
+  /* 3. Checks if blocks escaped coalescing */
+  if (GET_ALLOC(HDRP(bp)) == 0 && GET_ALLOC(HDRP(NEXT_BLKP(bp))) == 0) {
+    printf("ERROR: blocks not coalesced!\n");
+    return 0;
+  }
+  return 1;
+}
+
+/* 
+ * frag_block - heap_walk visitor for mm_frag, adds block bp to the
+ *              mm_frag_t in arg
+ */
+static int frag_block(char *bp, void *arg) {
+  mm_frag_t *frag = arg;
+  size_t size = GET_SIZE(HDRP(bp));
+  unsigned int cls;
+  run_t *run;
+
+  if (!GET_ALLOC(HDRP(bp)))
+    frag_free(frag, size);
+  else if ((cls = pagemap_get(bp)) != 0) { // a slab run
+    run = (run_t *) bp;
+    frag->slab_bytes += size;
+    frag->slab_used_bytes += (size_t) (run->nobjs - run->nfree) * class_sizes[cls - 1];
+  }
+  else {
+    frag->alloc_bytes += size;
+  }
+  return 1;
+}
+
+/* 
+ * frag_free - adds a free block of size bytes to frag
+ */
+static void frag_free(mm_frag_t *frag, size_t size) {
+  int k;
+
+  frag->free_bytes += size;
+  frag->free_blocks++;
+  if (size > frag->largest_free)
+    frag->largest_free = size;
+  k = (int) (sizeof(unsigned long) * 8) - 1 - __builtin_clzl((unsigned long) size);
+  frag->free_hist[k < MM_FRAG_BINS ? k : MM_FRAG_BINS - 1]++;
+  if (size < TREE_MIN_SIZE) {
+    k = find_bucket(size / WSIZE);
+    frag->bucket_blocks[k]++;
+    frag->bucket_bytes[k] += size;
+  }
+}
+
+/* 
+ * mm_frag - walks the heap and fills frag with how its bytes are spread
+ *           over allocated blocks, slab runs and free blocks
+ *           takes every arena lock for the length of the walk
+ */
+void mm_frag(mm_frag_t *frag) {
+  char *node;
+  int i, k;
+
+  memset(frag, 0, sizeof(*frag));
+  if (heap_listp == 0)
+    return;
+
+  for (i = 0; i < narenas; i++) // index order, nobody else holds two
+    pthread_mutex_lock(&arenas[i].lock);
+  heap_walk(frag_block, frag);
+  for (i = 0; i < narenas; i++) { // fast bin blocks look allocated to the walk
+    for (k = 0; k < FASTBINS; k++) {
+      for (node = arenas[i].fastbins[k]; node != 0x0; node = NEXT_FREE(node)) {
+        frag->alloc_bytes -= GET_SIZE(HDRP(node));
+        frag_free(frag, GET_SIZE(HDRP(node)));
+      }
+    }
+  }
+  for (i = narenas - 1; i >= 0; i--)
+    pthread_mutex_unlock(&arenas[i].lock);
+
+  pthread_mutex_lock(&sbrk_lock);
+  frag->heap_bytes = mem_heapsize();
+  pthread_mutex_unlock(&sbrk_lock);
+}
+
+/* 
  * mm_check - heap consistency checker
+ *            walks every segment from its prologue to its epilogue
  */
 int mm_check(void) {
-  size_t *bp;
+  char *node;
+  int i, k;
 
-  /* 1. Checks whether headers and footer match */
-  bp = NEXT_BLKP(heap_listp);
-  while (bp <= mem_heap_hi()) {
-    if (GET(HDRP(bp)) != GET(FTRP(bp))) {
-      printf("ERROR: header and footer do not match!\n");
-      return 0;
+  /* 1. and 3., see check_block */
+  if (!heap_walk(check_block, NULL))
+    return 0;
+
+  /* 4. Checks whether partial runs are mapped and have free objects */
+  for (i = 0; i < narenas; i++) {
+    for (k = 0; k < SLAB_CLASSES; k++) {
+      run_t *run;
+      for (run = arenas[i].runs[k]; run != NULL; run = run->next) {
+        if (run->nfree == 0 || pagemap_get(run) != (unsigned int) k + 1) {
+          printf("ERROR: bad run in partial list!\n");
+          return 0;
+        }
+      }
     }
-    bp = NEXT_BLKP(bp);
   }
 
-  /* 2. Checks whether allocated blocks are in seglist */
-  size_t *node;
-  size_t *bucket = (size_t *) mem_heap_lo();
-  while (bucket < (size_t *) mem_heap_lo() + BUCKETS_COUNT) { // iterates over seglist
-    node = GET(bucket);
-    while (node != 0x0) { // iterates over linked list
-      if (GET_ALLOC(HDRP(node)) != 0) // if block isn't free, return error
-        printf("ERROR: allocated block in free seglist!\n");
-        return 0;
-      node = GET(node); // next node
+  /* 5. Checks whether the tree holds free blocks in (size, address) order */
+  for (i = 0; i < narenas; i++) {
+    if (!tree_check(arenas[i].tree, 0x0, 0x0)) {
+      printf("ERROR: large block tree is corrupt!\n");
+      return 0;
     }
-    bucket++; // increment bucket
   }
 
-  /* 3. Checks if blocks escaped coalescing */
-  bp = NEXT_BLKP(heap_listp);
-  while (bp <= mem_heap_hi()) {
-    if (GET_ALLOC(HDRP(bp)) == 0 && GET_ALLOC(HDRP(NEXT_BLKP(bp))) == 0) {
-      printf("ERROR: blocks not coalesced!\n");
+  /* 6. Checks whether fast bins hold blocks of their size, marked allocated */
+  for (i = 0; i < narenas; i++) {
+    size_t bytes = 0;
+    for (k = 0; k < FASTBINS; k++) {
+      for (node = arenas[i].fastbins[k]; node != 0x0; node = NEXT_FREE(node)) {
+        if (!GET_ALLOC(HDRP(node)) || GET_SIZE(HDRP(node)) >> LINK_SHIFT != (size_t) k) {
+          printf("ERROR: bad block in fast bin!\n");
+          return 0;
+        }
+        bytes += GET_SIZE(HDRP(node));
+      }
+    }
+    if (bytes != arenas[i].fast_bytes) {
+      printf("ERROR: fast bin byte count is off!\n");
       return 0;
     }
-    bp = NEXT_BLKP(bp);
+  }
+
+  /* 2. Checks whether allocated blocks are in seglist */
+  for (i = 0; i < narenas; i++) {
+    for (k = 0; k < BUCKETS_COUNT; k++) { // iterates over seglist
+      node = arenas[i].buckets[k];
+      while (node != 0x0) { // iterates over linked list
+        if (GET_ALLOC(HDRP(node)) != 0) { // if block isn't free, return error
+          printf("ERROR: allocated block in free seglist!\n");
+          return 0;
+        }
+        node = NEXT_FREE(node); // next node
+      }
+    }
   }
 
   return 1; // heap is consistent
-}
\ No newline at end of file
+}
@@ -4,6 +4,74 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/* Aligned blocks, alignment a power of two; free them with mm_free */
+extern void *mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/* Many blocks at once, see mm.c */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_bulk(void **ptrs, size_t n);
+
+/*
+ * Free with the size passed to the mm_malloc, mm_calloc, mm_realloc or
+ * mm_malloc_batch that returned ptr. Blocks from mm_memalign,
+ * mm_posix_memalign and mm_aligned_alloc must not be freed this way
+ */
+extern void mm_free_sized(void *ptr, size_t size);
+
+/* Arena assignment policies for mm_set_arenas */
+#define MM_ARENA_ROUND_ROBIN 0  /* threads take arenas in turn */
+#define MM_ARENA_PER_CPU     1  /* arena chosen by sched_getcpu() */
+
+extern int mm_set_arenas(int count, int policy);
+
+/* Returning memory to the OS, see mm.c for the defaults */
+extern void mm_set_trim_threshold(size_t bytes);
+extern void mm_set_decay(long decay_ms);
+extern void mm_set_mmap_threshold(size_t bytes);
+
+/* Allocator statistics filled in by mm_stats */
+#define MM_STATS_BUCKETS 32
+typedef struct {
+    size_t live_bytes;       /* bytes in allocated heap blocks and slab objects */
+    size_t mmap_bytes;       /* bytes in mmap'ed blocks */
+    size_t heap_size;        /* bytes between heap start and brk */
+    size_t free_bytes[MM_STATS_BUCKETS];  /* free bytes in each seglist bucket */
+    size_t free_blocks[MM_STATS_BUCKETS]; /* free blocks in each seglist bucket */
+    size_t tree_free_bytes;  /* free bytes in large blocks */
+    size_t tree_free_blocks; /* number of large free blocks */
+    size_t fast_free_bytes;  /* free bytes waiting uncoalesced in fast bins */
+    size_t fast_free_blocks; /* number of fast bin blocks */
+    unsigned long mallocs;   /* successful mm_malloc calls */
+    unsigned long frees;     /* mm_free calls */
+    unsigned long splits;    /* blocks split in two */
+    unsigned long coalesces; /* free neighbours merged */
+    unsigned long extends;   /* extend_heap calls */
+    unsigned long realloc_in_place; /* mm_realloc calls that kept the block */
+    unsigned long realloc_moves;    /* mm_realloc calls that moved the block */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/* Heap layout filled in by mm_frag, mmap'ed blocks are not part of it */
+#define MM_FRAG_BINS 32
+typedef struct {
+    size_t heap_bytes;       /* bytes between heap start and brk */
+    size_t alloc_bytes;      /* bytes in allocated blocks, runs excluded */
+    size_t slab_bytes;       /* bytes in slab runs */
+    size_t slab_used_bytes;  /* objects in use or thread cached, in bytes */
+    size_t free_bytes;       /* bytes in free blocks */
+    size_t free_blocks;      /* number of free blocks */
+    size_t largest_free;     /* size of the largest free block */
+    size_t free_hist[MM_FRAG_BINS];       /* free blocks of 2^i to 2^(i+1)-1 bytes */
+    size_t bucket_blocks[MM_STATS_BUCKETS]; /* free blocks in each seglist bucket */
+    size_t bucket_bytes[MM_STATS_BUCKETS];  /* free bytes in each seglist bucket */
+} mm_frag_t;
+
+extern void mm_frag(mm_frag_t *frag);
 
 
 /* 
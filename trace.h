@@ -0,0 +1,32 @@
+/*
+ * trace.h - Binary trace format shared by mdriver and tracecvt
+ *
+ * A binary trace is a trace_hdr_t followed by num_ops trace_rec_t
+ * records, all in host byte order. The records have the layout of
+ * mdriver's traceop_t, so mdriver maps the file and replays the
+ * records in place without parsing them.
+ */
+#include <stdint.h>
+
+#define TRACE_MAGIC   0x52544d4d  /* "MMTR" on a little endian host */
+#define TRACE_VERSION 1
+
+/* Request types, the same values as mdriver's ALLOC, FREE and REALLOC */
+#define TRACE_ALLOC   0
+#define TRACE_FREE    1
+#define TRACE_REALLOC 2
+
+typedef struct {
+    uint32_t magic;         /* TRACE_MAGIC */
+    uint32_t version;       /* TRACE_VERSION */
+    uint32_t sugg_heapsize; /* suggested heap size (unused) */
+    uint32_t num_ids;       /* number of alloc/realloc ids */
+    uint32_t num_ops;       /* number of records that follow */
+    uint32_t weight;        /* weight for this trace (unused) */
+} trace_hdr_t;
+
+typedef struct {
+    int32_t type;           /* TRACE_ALLOC, TRACE_FREE or TRACE_REALLOC */
+    int32_t index;          /* block id, 0 <= index < num_ids */
+    int32_t size;           /* payload bytes, 0 for TRACE_FREE */
+} trace_rec_t;
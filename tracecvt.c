@@ -0,0 +1,176 @@
+/*
+ * tracecvt.c - Convert malloc lab traces between the text .rep format
+ *     and the binary format of trace.h
+ *
+ * usage: tracecvt <in> <out>
+ *
+ * A binary <in> is written to <out> as text, anything else is parsed
+ * as a text trace and written to <out> as a binary trace. Both
+ * directions check that every request names a valid block id.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+static char *inpath;  /* file being converted, for error messages */
+
+/*
+ * cvt_error - Report a problem with the input trace and exit
+ */
+static void cvt_error(unsigned long line, char *msg)
+{
+    if (line)
+	fprintf(stderr, "tracecvt: %s, line %lu: %s\n", inpath, line, msg);
+    else
+	fprintf(stderr, "tracecvt: %s: %s\n", inpath, msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a failed system call and exit
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "tracecvt: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * check_rec - Make sure record r of a trace with num_ids ids is sane
+ */
+static void check_rec(trace_rec_t *r, uint32_t num_ids, unsigned long line)
+{
+    if (r->type != TRACE_ALLOC && r->type != TRACE_FREE &&
+	r->type != TRACE_REALLOC)
+	cvt_error(line, "bad request type");
+    if (r->index < 0 || (uint32_t)r->index >= num_ids)
+	cvt_error(line, "block id out of range");
+    if (r->type != TRACE_FREE && r->size < 0)
+	cvt_error(line, "negative size");
+}
+
+/*
+ * text_to_bin - Parse the text trace in and write it to out in binary
+ */
+static void text_to_bin(FILE *in, FILE *out)
+{
+    trace_hdr_t hdr;
+    trace_rec_t r;
+    char buf[MAXLINE], *p;
+    unsigned long line = 0, ops = 0;
+    uint32_t *hdr_fields[4];
+    int i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr_fields[0] = &hdr.sugg_heapsize;
+    hdr_fields[1] = &hdr.num_ids;
+    hdr_fields[2] = &hdr.num_ops;
+    hdr_fields[3] = &hdr.weight;
+    for (i = 0; i < 4; i++) {
+	line++;
+	if (fgets(buf, MAXLINE, in) == NULL)
+	    cvt_error(line, "truncated header");
+	*hdr_fields[i] = (uint32_t)strtoul(buf, NULL, 10);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	unix_error("write");
+
+    while (fgets(buf, MAXLINE, in) != NULL) {
+	line++;
+	p = buf + strspn(buf, " \t");
+	if (*p == '\n' || *p == '\0')
+	    continue;
+	switch (*p) {
+	case 'a':
+	    r.type = TRACE_ALLOC;
+	    break;
+	case 'r':
+	    r.type = TRACE_REALLOC;
+	    break;
+	case 'f':
+	    r.type = TRACE_FREE;
+	    break;
+	default:
+	    cvt_error(line, "bogus type character");
+	}
+	r.index = (int32_t)strtol(p + 1, &p, 10);
+	r.size = (r.type == TRACE_FREE) ? 0 : (int32_t)strtol(p, &p, 10);
+	check_rec(&r, hdr.num_ids, line);
+	if (fwrite(&r, sizeof(r), 1, out) != 1)
+	    unix_error("write");
+	ops++;
+    }
+    if (ops != hdr.num_ops)
+	cvt_error(0, "number of requests does not match the header");
+}
+
+/*
+ * bin_to_text - Write the binary trace in (header hdr already read)
+ *     to out as text
+ */
+static void bin_to_text(trace_hdr_t *hdr, FILE *in, FILE *out)
+{
+    trace_rec_t r;
+    unsigned long i;
+
+    if (hdr->version != TRACE_VERSION)
+	cvt_error(0, "unsupported binary trace version");
+    fprintf(out, "%u\n%u\n%u\n%u\n", hdr->sugg_heapsize, hdr->num_ids,
+	    hdr->num_ops, hdr->weight);
+    for (i = 0; i < hdr->num_ops; i++) {
+	if (fread(&r, sizeof(r), 1, in) != 1)
+	    cvt_error(0, "truncated binary trace");
+	check_rec(&r, hdr->num_ids, 0);
+	switch (r.type) {
+	case TRACE_ALLOC:
+	    fprintf(out, "a %d %d\n", r.index, r.size);
+	    break;
+	case TRACE_REALLOC:
+	    fprintf(out, "r %d %d\n", r.index, r.size);
+	    break;
+	case TRACE_FREE:
+	    fprintf(out, "f %d\n", r.index);
+	    break;
+	}
+    }
+    if (fgetc(in) != EOF)
+	cvt_error(0, "trailing bytes after the last record");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    trace_hdr_t hdr;
+    size_t n;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: tracecvt <in> <out>\n");
+	fprintf(stderr, "\tConverts a text trace to binary or a binary trace to text.\n");
+	exit(1);
+    }
+    inpath = argv[1];
+    if ((in = fopen(argv[1], "rb")) == NULL)
+	unix_error(argv[1]);
+    if ((out = fopen(argv[2], "wb")) == NULL)
+	unix_error(argv[2]);
+
+    n = fread(&hdr, 1, sizeof(hdr), in);
+    if (n == sizeof(hdr) && hdr.magic == TRACE_MAGIC)
+	bin_to_text(&hdr, in, out);
+    else {
+	rewind(in);
+	text_to_bin(in, out);
+    }
+
+    if (fclose(out) != 0)
+	unix_error(argv[2]);
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,483 @@
+/*
+ * tracegen.c - Generate synthetic malloc lab traces from a workload spec
+ *
+ * usage: tracegen [-b] [-n <ops>] [-s <sizes>] [-l <lifetimes>]
+ *                 [-L <bytes>] [-r <p>:<growth>] [-S <seed>] [-o <file>]
+ *
+ * Each step either allocates a block or, once the live heap would grow
+ * past the target, frees the block the lifetime model picks. At the end
+ * every live block is freed, so the traces are balanced like the *-bal
+ * traces. The same options and seed always give the same trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "trace.h"
+
+#define MAXLINE   1024       /* max string size */
+#define MAX_SIZE  (1 << 30)  /* generated sizes are clamped to this */
+
+/* Size distributions */
+enum {UNIFORM, LOGNORMAL, BIMODAL, HISTOGRAM};
+
+/* Lifetime models: which live block a free picks */
+enum {LIFO, FIFO, RANDOM, EXPONENTIAL};
+
+/* A live block, kept in a binary min-heap ordered by key */
+typedef struct {
+    double key;      /* lifetime model's priority, smallest freed first */
+    int32_t id;      /* block id in the trace */
+    int32_t size;    /* current payload size */
+} live_t;
+
+/* Workload spec, set from the command line */
+static int size_dist = UNIFORM;
+static double size_a = 1, size_b = 4096, size_p = 0.5;
+static double *hist_sizes, *hist_cum;  /* histogram, cumulative weights */
+static int hist_n;
+static int life_model = RANDOM;
+static double life_mean = 1000;        /* mean lifetime in steps */
+static long target_live = 1 << 20;     /* live heap size to hold */
+static double realloc_p = 0;           /* chance a step reallocs a block */
+static double realloc_f = 1.5;         /* ... and multiplies its size by this */
+static int realloc_add = 0;            /* ... or adds this many bytes */
+
+/* Generator state */
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+static live_t *heap;
+static int heap_n, heap_cap;
+static int32_t *free_ids;
+static int free_n;
+static int32_t num_ids;
+static trace_rec_t *ops;
+static long num_ops, ops_cap;
+static long live_bytes, peak_bytes;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tracegen [-b] [-n <ops>] [-s <sizes>] [-l <lifetimes>]\n");
+    fprintf(stderr, "                [-L <bytes>] [-r <p>:<growth>] [-S <seed>] [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b              Write a binary trace instead of text.\n");
+    fprintf(stderr, "\t-n <ops>        Steps to generate before freeing the rest (10000).\n");
+    fprintf(stderr, "\t-s uniform:<min>:<max>\n");
+    fprintf(stderr, "\t-s lognormal:<median>:<sigma>\n");
+    fprintf(stderr, "\t-s bimodal:<a>:<b>:<p>  Size a with probability p, else b.\n");
+    fprintf(stderr, "\t-s hist:<file>  Lines of \"<size> <weight>\".\n");
+    fprintf(stderr, "\t-l lifo|fifo|random|exp:<mean>  Which block a free picks;\n");
+    fprintf(stderr, "\t                exp frees blocks after exponential lifetimes.\n");
+    fprintf(stderr, "\t-L <bytes>      Live heap size to hold (1048576).\n");
+    fprintf(stderr, "\t-r <p>:<f>      Each step reallocs a live block with probability p,\n");
+    fprintf(stderr, "\t                scaling its size by f, or growing it by n for +n.\n");
+    fprintf(stderr, "\t-S <seed>       Random seed.\n");
+    fprintf(stderr, "\t-o <file>       Output file (stdout).\n");
+}
+
+static void app_error(char *msg)
+{
+    fprintf(stderr, "tracegen: %s\n", msg);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    if ((p = realloc(p, size)) == NULL)
+	app_error("out of memory");
+    return p;
+}
+
+/*
+ * rng - xorshift64*, so traces do not depend on the libc's rand()
+ */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform - Uniform double in [0, 1) */
+static double uniform(void)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* gaussian - Standard normal sample (Box-Muller) */
+static double gaussian(void)
+{
+    double u = uniform();
+
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * uniform());
+}
+
+static int32_t clamp_size(double size)
+{
+    if (size < 1)
+	return 1;
+    if (size > MAX_SIZE)
+	return MAX_SIZE;
+    return (int32_t)size;
+}
+
+/*
+ * next_size - Draw a request size from the size distribution
+ */
+static int32_t next_size(void)
+{
+    int lo, hi, mid;
+    double w;
+
+    switch (size_dist) {
+    case UNIFORM:
+	return clamp_size(size_a + uniform() * (size_b - size_a + 1));
+    case LOGNORMAL:
+	return clamp_size(size_a * exp(size_b * gaussian()));
+    case BIMODAL:
+	return clamp_size(uniform() < size_p ? size_a : size_b);
+    default: /* HISTOGRAM, binary search the cumulative weights */
+	w = uniform() * hist_cum[hist_n - 1];
+	lo = 0;
+	hi = hist_n - 1;
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (hist_cum[mid] > w)
+		hi = mid;
+	    else
+		lo = mid + 1;
+	}
+	return clamp_size(hist_sizes[lo]);
+    }
+}
+
+/*
+ * read_hist - Load a size histogram of "<size> <weight>" lines
+ */
+static void read_hist(char *path)
+{
+    FILE *f;
+    char buf[MAXLINE];
+    double size, weight, total = 0;
+
+    if ((f = fopen(path, "r")) == NULL) {
+	fprintf(stderr, "tracegen: %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    while (fgets(buf, MAXLINE, f) != NULL) {
+	if (sscanf(buf, "%lf %lf", &size, &weight) != 2 || weight <= 0)
+	    continue;
+	hist_sizes = xrealloc(hist_sizes, (hist_n + 1) * sizeof(double));
+	hist_cum = xrealloc(hist_cum, (hist_n + 1) * sizeof(double));
+	total += weight;
+	hist_sizes[hist_n] = size;
+	hist_cum[hist_n++] = total;
+    }
+    fclose(f);
+    if (hist_n == 0)
+	app_error("empty size histogram");
+}
+
+static void emit(int type, int32_t id, int32_t size)
+{
+    if (num_ops == ops_cap) {
+	ops_cap = ops_cap ? 2 * ops_cap : 4096;
+	ops = xrealloc(ops, ops_cap * sizeof(trace_rec_t));
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * Binary min-heap of live blocks
+ */
+static void heap_swap(int i, int j)
+{
+    live_t t = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = t;
+}
+
+static void heap_push(live_t b)
+{
+    int i, parent;
+
+    if (heap_n == heap_cap) {
+	heap_cap = heap_cap ? 2 * heap_cap : 1024;
+	heap = xrealloc(heap, heap_cap * sizeof(live_t));
+    }
+    i = heap_n++;
+    heap[i] = b;
+    while (i > 0 && heap[parent = (i - 1) / 2].key > heap[i].key) {
+	heap_swap(i, parent);
+	i = parent;
+    }
+}
+
+static live_t heap_pop(void)
+{
+    live_t top = heap[0];
+    int i = 0, child;
+
+    heap[0] = heap[--heap_n];
+    while ((child = 2 * i + 1) < heap_n) {
+	if (child + 1 < heap_n && heap[child + 1].key < heap[child].key)
+	    child++;
+	if (heap[i].key <= heap[child].key)
+	    break;
+	heap_swap(i, child);
+	i = child;
+    }
+    return top;
+}
+
+/* heap_remove - Take out the block at position i */
+static live_t heap_remove(int i)
+{
+    live_t b = heap[i];
+    int parent, child;
+
+    heap[i] = heap[--heap_n];
+    while (i > 0 && heap[parent = (i - 1) / 2].key > heap[i].key) {
+	heap_swap(i, parent);
+	i = parent;
+    }
+    while ((child = 2 * i + 1) < heap_n) {
+	if (child + 1 < heap_n && heap[child + 1].key < heap[child].key)
+	    child++;
+	if (heap[i].key <= heap[child].key)
+	    break;
+	heap_swap(i, child);
+	i = child;
+    }
+    return b;
+}
+
+/*
+ * alloc_block - Allocate a block of size bytes at step now
+ */
+static void alloc_block(int32_t size, long now)
+{
+    live_t b;
+
+    b.id = free_n ? free_ids[--free_n] : num_ids++;
+    b.size = size;
+    switch (life_model) {
+    case LIFO:
+	b.key = -now;
+	break;
+    case FIFO:
+	b.key = now;
+	break;
+    case RANDOM:
+	b.key = uniform();
+	break;
+    default: /* EXPONENTIAL, the step it dies at */
+	b.key = now - life_mean * log(1.0 - uniform());
+	break;
+    }
+    emit(TRACE_ALLOC, b.id, size);
+    heap_push(b);
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * free_block - Free the block the lifetime model picks
+ */
+static void free_block(void)
+{
+    live_t b = heap_pop();
+
+    emit(TRACE_FREE, b.id, 0);
+    free_ids[free_n++] = b.id;  /* never more than num_ids */
+    live_bytes -= b.size;
+}
+
+/*
+ * realloc_block - Resize a random live block as the growth pattern says.
+ *     Growth first frees other blocks, as an allocation would, and is
+ *     cut short if the block alone would pass the target live size.
+ */
+static void realloc_block(void)
+{
+    live_t b = heap_remove(rng() % heap_n);
+    int32_t size;
+
+    size = realloc_add ? clamp_size((double)b.size + realloc_add) :
+	clamp_size(b.size * realloc_f);
+    while (size > b.size && heap_n > 0 && 
+	   live_bytes + size - b.size > target_live)
+	free_block();
+    if (size > b.size && live_bytes + size - b.size > target_live)
+	size = target_live - (live_bytes - b.size) > b.size ?
+	    target_live - (live_bytes - b.size) : b.size;
+    emit(TRACE_REALLOC, b.id, size);
+    live_bytes += size - b.size;
+    b.size = size;
+    heap_push(b);
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * parse_sizes - Parse the -s argument
+ */
+static void parse_sizes(char *arg)
+{
+    if (!strncmp(arg, "uniform:", 8) &&
+	sscanf(arg + 8, "%lf:%lf", &size_a, &size_b) == 2 && size_a <= size_b)
+	size_dist = UNIFORM;
+    else if (!strncmp(arg, "lognormal:", 10) &&
+	     sscanf(arg + 10, "%lf:%lf", &size_a, &size_b) == 2)
+	size_dist = LOGNORMAL;
+    else if (!strncmp(arg, "bimodal:", 8) &&
+	     sscanf(arg + 8, "%lf:%lf:%lf", &size_a, &size_b, &size_p) == 3)
+	size_dist = BIMODAL;
+    else if (!strncmp(arg, "hist:", 5)) {
+	size_dist = HISTOGRAM;
+	read_hist(arg + 5);
+    }
+    else {
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * parse_lifetimes - Parse the -l argument
+ */
+static void parse_lifetimes(char *arg)
+{
+    if (!strcmp(arg, "lifo"))
+	life_model = LIFO;
+    else if (!strcmp(arg, "fifo"))
+	life_model = FIFO;
+    else if (!strcmp(arg, "random"))
+	life_model = RANDOM;
+    else if (!strncmp(arg, "exp:", 4) && (life_mean = atof(arg + 4)) > 0)
+	life_model = EXPONENTIAL;
+    else {
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * write_trace - Write the generated requests to out as text or binary
+ */
+static void write_trace(FILE *out, int binary)
+{
+    trace_hdr_t hdr;
+    long i;
+
+    if (binary) {
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.sugg_heapsize = peak_bytes > UINT32_MAX ? UINT32_MAX : peak_bytes;
+	hdr.num_ids = num_ids;
+	hdr.num_ops = num_ops;
+	hdr.weight = 1;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(ops, sizeof(trace_rec_t), num_ops, out) != num_ops)
+	    app_error("write failed");
+	return;
+    }
+
+    fprintf(out, "%ld\n%d\n%ld\n%d\n", peak_bytes, num_ids, num_ops, 1);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == TRACE_FREE)
+	    fprintf(out, "f %d\n", ops[i].index);
+	else
+	    fprintf(out, "%c %d %d\n", ops[i].type == TRACE_ALLOC ? 'a' : 'r',
+		    ops[i].index, ops[i].size);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long steps = 10000, now;
+    int c, binary = 0;
+    int32_t size;
+    char *outpath = NULL, *p;
+    FILE *out = stdout;
+
+    while ((c = getopt(argc, argv, "bn:s:l:L:r:S:o:h")) != EOF) {
+	switch (c) {
+	case 'b': /* Binary output */
+	    binary = 1;
+	    break;
+	case 'n': /* Number of steps */
+	    steps = atol(optarg);
+	    break;
+	case 's': /* Size distribution */
+	    parse_sizes(optarg);
+	    break;
+	case 'l': /* Lifetime model */
+	    parse_lifetimes(optarg);
+	    break;
+	case 'L': /* Target live heap size */
+	    target_live = atol(optarg);
+	    break;
+	case 'r': /* Realloc probability and growth */
+	    realloc_p = strtod(optarg, &p);
+	    if (*p != ':') {
+		usage();
+		exit(1);
+	    }
+	    if (p[1] == '+')
+		realloc_add = atoi(p + 2);
+	    else
+		realloc_f = atof(p + 1);
+	    break;
+	case 'S': /* Random seed, 0 is not a valid xorshift state */
+	    rng_state ^= strtoull(optarg, NULL, 0) * 0x9e3779b97f4a7c15ULL;
+	    if (rng_state == 0)
+		rng_state = 1;
+	    break;
+	case 'o': /* Output file */
+	    outpath = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    for (now = 0; now < steps; now++) {
+	while (life_model == EXPONENTIAL && heap_n > 0 && heap[0].key <= now)
+	    free_block();
+	if (heap_n > 0 && uniform() < realloc_p) {
+	    realloc_block();
+	    continue;
+	}
+	size = next_size();
+	while (heap_n > 0 && live_bytes + size > target_live)
+	    free_block();
+	if (free_n == 0) /* room to free the id alloc_block creates */
+	    free_ids = xrealloc(free_ids, (num_ids + 1) * sizeof(int32_t));
+	alloc_block(size, now);
+    }
+    while (heap_n > 0)
+	free_block();
+
+    if (outpath != NULL && (out = fopen(outpath, binary ? "wb" : "w")) == NULL) {
+	fprintf(stderr, "tracegen: %s: %s\n", outpath, strerror(errno));
+	exit(1);
+    }
+    write_trace(out, binary);
+    if (fclose(out) != 0)
+	app_error("write failed");
+    return 0;
+}
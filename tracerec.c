@@ -0,0 +1,645 @@
+/*
+ * tracerec.c - Record the allocations of a running program as a trace
+ *
+ * Build tracerec.so and preload it:
+ *
+ *     TRACEREC_OUT=app.rep LD_PRELOAD=./tracerec.so app ...
+ *
+ * Without TRACEREC_OUT the trace goes to tracerec.<pid>.rep, which is
+ * what you want when app runs other programs that inherit the preload.
+ *
+ * Every malloc, calloc, realloc and free is appended to a per-thread
+ * buffer together with a sequence number from a global counter, so the
+ * hot path takes no lock. A realloc is logged as two records, the release
+ * of the old block and the new block, each numbered like a free and a
+ * malloc would be. Full buffers are written to a raw log next to
+ * the output file. When the program exits the raw log is sorted by
+ * sequence number, addresses are turned into block ids (reused once a
+ * block is freed, which keeps num_ids near the peak number of live
+ * blocks) and the result is written as a .rep text trace that mdriver
+ * can replay or tracecvt can turn into a binary trace.
+ *
+ * Limitations: blocks from memalign and friends are not recorded (their
+ * frees are dropped as unknown blocks), sizes above INT32_MAX are
+ * clamped, zero byte requests are skipped, forked children are not
+ * recorded, and threads still running at exit may lose their last few
+ * records.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define REC_BUF   4096        /* records buffered per thread */
+#define BOOT_SIZE (64*1024)   /* static heap for allocations made by dlsym */
+#define MAP_MIN   1024        /* initial slots in the address to id map */
+#define RAW_RELEASE 3         /* raw record type of the first half of a realloc */
+
+/* One intercepted call, as written to the raw log */
+typedef struct {
+    uint64_t seq;    /* global order of the call */
+    uint64_t ptr;    /* block returned, or the block freed */
+    uint64_t link;   /* of a TRACE_REALLOC, seq + 1 of its RAW_RELEASE or 0 */
+    uint32_t size;   /* requested bytes */
+    uint32_t type;   /* TRACE_ALLOC, TRACE_FREE, TRACE_REALLOC or RAW_RELEASE */
+} raw_rec_t;
+
+/* A thread's record buffer */
+typedef struct rec_buf {
+    raw_rec_t recs[REC_BUF];
+    int count;
+    struct rec_buf *next;    /* list of every buffer, flushed at exit */
+    struct rec_buf *next_free; /* free_bufs link while no thread owns it */
+} rec_buf_t;
+
+/* Slot of the address to block id map used when writing the trace */
+typedef struct {
+    uint64_t ptr;    /* 0 for an empty slot */
+    int32_t id;
+    uint32_t size;
+} id_slot_t;
+
+/* Block released by a realloc whose new block is not replayed yet */
+typedef struct {
+    uint64_t link;   /* seq + 1 of the RAW_RELEASE */
+    uint64_t ptr;    /* the released block */
+    int32_t id;      /* its id, -1 if the block was unknown */
+    uint32_t size;
+} pending_t;
+
+static void *(*real_malloc)(size_t size);
+static void *(*real_calloc)(size_t nmemb, size_t size);
+static void *(*real_realloc)(void *ptr, size_t size);
+static void (*real_free)(void *ptr);
+
+static char boot_heap[BOOT_SIZE];  /* serves dlsym before real_* are known */
+static size_t boot_used = 0;
+static int resolving = 0;
+
+static int recording = 0;          /* set between init and fini */
+static uint64_t next_seq = 0;      /* global sequence counter */
+static int raw_fd = -1;
+static char out_path[PATH_MAX];
+static char raw_path[PATH_MAX];
+static rec_buf_t *all_bufs = NULL;
+static rec_buf_t *free_bufs = NULL; /* buffers of exited threads */
+static pthread_mutex_t free_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buf_key;      /* flushes a thread's buffer at exit */
+
+static __thread rec_buf_t *my_buf = NULL;
+static __thread int in_hook = 0;   /* set while the recorder allocates */
+
+/* State of the trace writer */
+static id_slot_t *id_map;
+static size_t map_slots, map_used;
+static int32_t *free_ids;
+static size_t free_count, free_cap;
+static int32_t num_ids;
+static trace_rec_t *ops;
+static size_t num_ops, ops_cap;
+static size_t live_bytes, peak_bytes;
+static pending_t *pending;
+static size_t pending_count, pending_cap;
+static jmp_buf writer_oom;         /* taken when the writer runs out of memory */
+
+/*
+ * resolve - Look up the allocator functions we wrap
+ */
+static void resolve(void)
+{
+    if (resolving)
+	return;
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+}
+
+/*
+ * boot_alloc - Bump allocate zeroed memory from boot_heap, with the
+ *     size stored in the word before the block
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t *p;
+
+    if (size > BOOT_SIZE)
+	return NULL;
+    size = (size + 2*sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+    if (boot_used + size > BOOT_SIZE)
+	return NULL;
+    p = (size_t *)(boot_heap + boot_used);
+    boot_used += size;
+    *p = size - sizeof(size_t);
+    return p + 1;
+}
+
+#define IS_BOOT(p) ((char *)(p) >= boot_heap && (char *)(p) < boot_heap + BOOT_SIZE)
+
+/*
+ * tracing - True if calls made now by this thread should be recorded
+ */
+static int tracing(void)
+{
+    return __atomic_load_n(&recording, __ATOMIC_ACQUIRE) && !in_hook;
+}
+
+/*
+ * flush - Append the records of buf to the raw log
+ */
+static void flush(rec_buf_t *buf)
+{
+    char *p = (char *)buf->recs;
+    size_t left = buf->count * sizeof(raw_rec_t);
+    ssize_t n;
+
+    while (left > 0 && (n = write(raw_fd, p, left)) > 0) {
+	p += n;
+	left -= n;
+    }
+    buf->count = 0;
+}
+
+/*
+ * thread_exit - pthread key destructor, flushes an exiting thread and
+ *     puts its buffer on free_bufs for the next new thread
+ */
+static void thread_exit(void *arg)
+{
+    rec_buf_t *buf = (rec_buf_t *)arg;
+
+    if (__atomic_load_n(&recording, __ATOMIC_ACQUIRE))
+	flush(buf);
+    else
+	buf->count = 0;
+    my_buf = NULL;
+    pthread_mutex_lock(&free_lock);
+    buf->next_free = free_bufs;
+    free_bufs = buf;
+    pthread_mutex_unlock(&free_lock);
+}
+
+/*
+ * get_buf - Reuse the buffer of an exited thread, or map a new one
+ */
+static rec_buf_t *get_buf(void)
+{
+    rec_buf_t *buf;
+
+    pthread_mutex_lock(&free_lock);
+    if ((buf = free_bufs) != NULL)
+	free_bufs = buf->next_free;
+    pthread_mutex_unlock(&free_lock);
+    if (buf != NULL)
+	return buf;
+
+    buf = mmap(NULL, sizeof(rec_buf_t), PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+	return NULL;
+    buf->next = __atomic_load_n(&all_bufs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&all_bufs, &buf->next, buf, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+    return buf;
+}
+
+/*
+ * fork_child - A forked child would log into its parent's raw log,
+ *     duplicating the parent's buffered records, so it records nothing
+ */
+static void fork_child(void)
+{
+    __atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * record - Add one call to this thread's buffer
+ */
+static void record(int type, void *ptr, uint64_t link, size_t size, uint64_t seq)
+{
+    rec_buf_t *buf = my_buf;
+    raw_rec_t *r;
+
+    if (buf == NULL) {
+	if ((buf = get_buf()) == NULL)
+	    return;
+	my_buf = buf;
+	in_hook = 1;
+	pthread_setspecific(buf_key, buf);
+	in_hook = 0;
+    }
+
+    r = &buf->recs[buf->count++];
+    r->seq = seq;
+    r->ptr = (uintptr_t)ptr;
+    r->link = link;
+    r->size = size > INT32_MAX ? INT32_MAX : (uint32_t)size;
+    r->type = type;
+    if (buf->count == REC_BUF)
+	flush(buf);
+}
+
+static uint64_t take_seq(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+/**********************
+ * Wrapped entry points
+ **********************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL)
+	resolve();
+    if (real_malloc == NULL)
+	return boot_alloc(size);
+    p = real_malloc(size);
+    if (p != NULL && size > 0 && tracing())
+	record(TRACE_ALLOC, p, 0, size, take_seq());
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size)
+	return NULL;
+    if (real_calloc == NULL)
+	resolve();
+    if (real_calloc == NULL)
+	return boot_alloc(nmemb * size);
+    p = real_calloc(nmemb, size);
+    if (p != NULL && nmemb * size > 0 && tracing())
+	record(TRACE_ALLOC, p, 0, nmemb * size, take_seq());
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    uint64_t link = 0;
+
+    if (IS_BOOT(ptr)) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, ((size_t *)ptr)[-1] < size ? ((size_t *)ptr)[-1] : size);
+	return p;
+    }
+    if (real_realloc == NULL)
+	resolve();
+    if (real_realloc == NULL)
+	return boot_alloc(size);
+    if (!tracing())
+	return real_realloc(ptr, size);
+
+    /*
+     * ptr is numbered before it can be handed out again, as in free, and
+     * the new block once it is ours, as in malloc
+     */
+    if (ptr != NULL) {
+	link = take_seq() + 1;
+	record(RAW_RELEASE, ptr, 0, 0, link - 1);
+    }
+    p = real_realloc(ptr, size);
+    record(TRACE_REALLOC, p, link, size, take_seq());
+    return p;
+}
+
+void free(void *ptr)
+{
+    uint64_t seq;
+
+    if (ptr == NULL || IS_BOOT(ptr))
+	return;
+    if (real_free == NULL)
+	resolve();
+
+    /*
+     * Number the free before the block can be handed out again, so an
+     * allocation of the same address on another thread comes later
+     */
+    if (tracing()) {
+	seq = take_seq();
+	real_free(ptr);
+	record(TRACE_FREE, ptr, 0, 0, seq);
+    }
+    else
+	real_free(ptr);
+}
+
+/*******************************************
+ * Turning the raw log into a .rep trace
+ *******************************************/
+
+/* writer_realloc - real_realloc that gives up on the trace when it fails */
+static void *writer_realloc(void *p, size_t size)
+{
+    if ((p = real_realloc(p, size)) == NULL)
+	longjmp(writer_oom, 1);
+    return p;
+}
+
+/* writer_calloc - real_calloc that gives up on the trace when it fails */
+static void *writer_calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if ((p = real_calloc(nmemb, size)) == NULL)
+	longjmp(writer_oom, 1);
+    return p;
+}
+
+static size_t map_hash(uint64_t ptr)
+{
+    return (size_t)((ptr >> 4) * 0x9e3779b97f4a7c15ULL) & (map_slots - 1);
+}
+
+/* map_find - Return the slot holding ptr, or the empty slot it would take */
+static id_slot_t *map_find(uint64_t ptr)
+{
+    size_t i = map_hash(ptr);
+
+    while (id_map[i].ptr != 0 && id_map[i].ptr != ptr)
+	i = (i + 1) & (map_slots - 1);
+    return &id_map[i];
+}
+
+static void map_put(uint64_t ptr, int32_t id, uint32_t size)
+{
+    id_slot_t *old = id_map, *s;
+    size_t i, n = map_slots;
+
+    if (2 * (map_used + 1) > map_slots) {
+	map_slots = map_slots ? 2 * map_slots : MAP_MIN;
+	id_map = writer_calloc(map_slots, sizeof(id_slot_t));
+	for (i = 0; i < n; i++)
+	    if (old[i].ptr != 0)
+		*map_find(old[i].ptr) = old[i];
+	real_free(old);
+    }
+    s = map_find(ptr);
+    s->ptr = ptr;
+    s->id = id;
+    s->size = size;
+    map_used++;
+}
+
+/* map_del - Empty slot s, moving later entries of its run back */
+static void map_del(id_slot_t *s)
+{
+    size_t i = s - id_map, j = i, home;
+
+    for (;;) {
+	j = (j + 1) & (map_slots - 1);
+	if (id_map[j].ptr == 0)
+	    break;
+	home = map_hash(id_map[j].ptr);
+	if ((j > i && (home <= i || home > j)) ||
+	    (j < i && home <= i && home > j)) {
+	    id_map[i] = id_map[j];
+	    i = j;
+	}
+    }
+    id_map[i].ptr = 0;
+    map_used--;
+}
+
+static void emit(int type, int32_t id, uint32_t size)
+{
+    if (num_ops == ops_cap) {
+	ops_cap = ops_cap ? 2 * ops_cap : 4096;
+	ops = writer_realloc(ops, ops_cap * sizeof(trace_rec_t));
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/* retire - Emit the free of block id and let a later block reuse the id */
+static void retire(int32_t id)
+{
+    emit(TRACE_FREE, id, 0);
+    if (free_count == free_cap) {
+	free_cap = free_cap ? 2 * free_cap : 1024;
+	free_ids = writer_realloc(free_ids, free_cap * sizeof(int32_t));
+    }
+    free_ids[free_count++] = id;
+}
+
+/* release - Emit the free of the block in slot s */
+static void release(id_slot_t *s)
+{
+    retire(s->id);
+    live_bytes -= s->size;
+    map_del(s);
+}
+
+/*
+ * hold - Take the block of slot s (empty if the block is unknown) out of
+ *     the map until the realloc that released it under link returns
+ */
+static void hold(id_slot_t *s, uint64_t ptr, uint64_t link)
+{
+    pending_t *h;
+
+    if (pending_count == pending_cap) {
+	pending_cap = pending_cap ? 2 * pending_cap : 64;
+	pending = writer_realloc(pending, pending_cap * sizeof(pending_t));
+    }
+    h = &pending[pending_count++];
+    h->link = link;
+    h->ptr = ptr;
+    h->id = -1;
+    h->size = 0;
+    if (s != NULL && s->ptr != 0) {
+	h->id = s->id;
+	h->size = s->size;
+	live_bytes -= s->size;
+	map_del(s);
+    }
+}
+
+/* unhold - Remove and return the block held under link, if any */
+static int unhold(uint64_t link, pending_t *out)
+{
+    size_t i;
+
+    for (i = 0; i < pending_count; i++) {
+	if (pending[i].link == link) {
+	    *out = pending[i];
+	    pending[i] = pending[--pending_count];
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* acquire - Give the new block ptr an id, first freeing a stale block */
+static void acquire(int type, uint64_t ptr, int32_t id, uint32_t size)
+{
+    id_slot_t *s;
+
+    if (map_slots > 0 && (s = map_find(ptr))->ptr != 0)
+	release(s);  /* racing calls on other threads were logged late */
+    if (id < 0)
+	id = free_count ? free_ids[--free_count] : num_ids++;
+    emit(type, id, size);
+    map_put(ptr, id, size);
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = ((raw_rec_t *)a)->seq, y = ((raw_rec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * write_trace - Replay the raw log through the id map and write the
+ *     trace to out_path
+ */
+static void write_trace(void)
+{
+    int fd;
+    struct stat st;
+    raw_rec_t *raw, *r;
+    id_slot_t *s;
+    pending_t h;
+    size_t i, n;
+    FILE *out;
+
+    if (real_calloc == NULL || real_realloc == NULL || real_free == NULL)
+	return;
+    if ((fd = open(raw_path, O_RDONLY)) < 0)
+	return;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+	close(fd);
+	return;
+    }
+    raw = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (raw == MAP_FAILED)
+	return;
+    n = st.st_size / sizeof(raw_rec_t);
+    qsort(raw, n, sizeof(raw_rec_t), cmp_seq);
+
+    /* Keep the raw log if the trace cannot be built */
+    if (setjmp(writer_oom)) {
+	fprintf(stderr, "tracerec: out of memory, %s not written\n", out_path);
+	munmap(raw, st.st_size);
+	return;
+    }
+
+    for (i = 0; i < n; i++) {
+	r = &raw[i];
+	s = (map_slots > 0 && r->type != TRACE_ALLOC && r->type != TRACE_REALLOC) ?
+	    map_find(r->ptr) : NULL;
+	switch (r->type) {
+	case TRACE_ALLOC:
+	    acquire(TRACE_ALLOC, r->ptr, -1, r->size);
+	    break;
+	case TRACE_FREE:
+	    if (s != NULL && s->ptr != 0)
+		release(s);
+	    break;
+	case RAW_RELEASE:
+	    hold(s, r->ptr, r->seq + 1);
+	    break;
+	case TRACE_REALLOC:
+	    if (r->link == 0 || !unhold(r->link, &h) || h.id < 0) {
+		if (r->ptr != 0 && r->size > 0) /* realloc(NULL) or unknown block */
+		    acquire(TRACE_ALLOC, r->ptr, -1, r->size);
+	    }
+	    else if (r->size == 0)                /* realloc(p, 0) frees p */
+		retire(h.id);
+	    else if (r->ptr == 0) {               /* failed, p is still live */
+		map_put(h.ptr, h.id, h.size);
+		live_bytes += h.size;
+	    }
+	    else
+		acquire(TRACE_REALLOC, r->ptr, h.id, r->size);
+	    break;
+	}
+    }
+    munmap(raw, st.st_size);
+
+    if ((out = fopen(out_path, "w")) == NULL)
+	return;
+    fprintf(out, "%lu\n%d\n%lu\n%d\n", (unsigned long)peak_bytes, num_ids,
+	    (unsigned long)num_ops, 1);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == TRACE_FREE)
+	    fprintf(out, "f %d\n", ops[i].index);
+	else
+	    fprintf(out, "%c %d %d\n", ops[i].type == TRACE_ALLOC ? 'a' : 'r',
+		    ops[i].index, ops[i].size);
+    }
+    fclose(out);
+    unlink(raw_path);
+}
+
+/*
+ * tracerec_init - Open the raw log and start recording
+ */
+__attribute__((constructor))
+static void tracerec_init(void)
+{
+    char *env = getenv("TRACEREC_OUT");
+    int n;
+
+    in_hook = 1;
+    resolve();
+    if (env != NULL && *env != '\0')
+	n = snprintf(out_path, sizeof(out_path), "%s", env);
+    else
+	n = snprintf(out_path, sizeof(out_path), "tracerec.%d.rep", (int)getpid());
+    if (n >= (int)sizeof(out_path) ||
+	snprintf(raw_path, sizeof(raw_path), "%s.raw", out_path) >= (int)sizeof(raw_path)) {
+	fprintf(stderr, "tracerec: output path too long, not recording\n");
+	in_hook = 0;
+	return;
+    }
+    raw_fd = open(raw_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (raw_fd >= 0 && pthread_key_create(&buf_key, thread_exit) == 0 &&
+	pthread_atfork(NULL, NULL, fork_child) == 0)
+	__atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+    in_hook = 0;
+}
+
+/*
+ * tracerec_fini - Stop recording, flush every buffer and write the trace
+ */
+__attribute__((destructor))
+static void tracerec_fini(void)
+{
+    rec_buf_t *buf;
+
+    if (!__atomic_exchange_n(&recording, 0, __ATOMIC_ACQ_REL))
+	return;
+    in_hook = 1;
+    for (buf = __atomic_load_n(&all_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next)
+	flush(buf);
+    close(raw_fd);
+    write_trace();
+}